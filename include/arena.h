@@ -0,0 +1,51 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_DEFAULT_BLOCK_LEN (64 * 1024)
+
+// enough for any reasonable output path, so per-resource scratch arenas backed by one never touch the heap
+#define ARENA_SCRATCH_LEN 4096
+
+typedef struct ArpArenaBlock arp_arena_block_t;
+
+typedef struct ArpArena {
+    arp_arena_block_t *blocks;
+    unsigned char *cur;
+    size_t cur_len;
+    size_t cur_used;
+    unsigned char *initial_buf;
+    size_t initial_len;
+    size_t block_len;
+    uint64_t alloc_count;
+} arp_arena_t;
+
+// only memory handed out through arenas is counted here, everything else is only visible in peak_rss_bytes
+typedef struct ArpAllocStats {
+    uint64_t arena_allocs;
+    uint64_t arena_blocks;
+    uint64_t peak_arena_block_bytes;
+    uint64_t peak_rss_bytes;
+} arp_alloc_stats_t;
+
+void arena_init(arp_arena_t *arena, void *initial_buf, size_t initial_len, size_t block_len);
+
+void *arena_alloc(arp_arena_t *arena, size_t len);
+
+char *arena_strdup(arp_arena_t *arena, const char *str);
+
+void arena_reset(arp_arena_t *arena);
+
+void arena_free(arp_arena_t *arena);
+
+void get_alloc_stats(arp_alloc_stats_t *out_stats);
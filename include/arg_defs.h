@@ -30,8 +30,21 @@
 #define FLAG_PART_SIZE_LONG "part-size"
 #define FLAG_RESOURCE_PATH_SHORT 'r'
 #define FLAG_RESOURCE_PATH_LONG "resource"
+#define FLAG_RECORD_ACCESS_LONG "record-access"
+#define FLAG_RANGE_LONG "range"
+#define FLAG_MEDIA_TYPE_LONG "media-type"
+#define FLAG_QUEUE_DEPTH_LONG "queue-depth"
+#define FLAG_JOBS_SHORT 'j'
+#define FLAG_JOBS_LONG "jobs"
 
 #define NFLAG_DEFLATE "deflate"
+#define NFLAG_INDEX "index"
+#define NFLAG_PROGRESS "progress"
+#define NFLAG_PLAN "plan"
+#define NFLAG_RESUME "resume"
+#define NFLAG_IO_URING "io-uring"
+#define NFLAG_REGEX "regex"
+#define NFLAG_FORCE "force"
 
 #define POS_VERB 0
 #define POS_SRC_PATH 1
@@ -41,5 +54,9 @@
 #define VERB_PACK "pack"
 #define VERB_UNPACK "unpack"
 #define VERB_LIST "list"
+#define VERB_WATCH "watch"
+#define VERB_BATCH "batch"
+#define VERB_RECOMPRESS "recompress"
+#define VERB_FIND "find"
 
 extern int make_iso_compilers_happy;
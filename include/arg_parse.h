@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 enum Verbosity {
     VerbosityNormal,
@@ -22,6 +23,7 @@ enum Verbosity {
 typedef struct ArpCmdArgs {
     bool is_help;
     enum Verbosity verbosity;
+    bool show_progress;
 
     char *verb;
     char *src_path;
@@ -31,7 +33,29 @@ typedef struct ArpCmdArgs {
     char *package_namespace;
     char *output_path;
     uint64_t part_size;
+    bool build_index;
+    bool plan_only;
     char *resource_path;
+    char *access_log_path;
+    bool resume;
+    bool use_io_uring;
+    size_t queue_depth;
+    bool has_range;
+    uint64_t range_offset;
+    uint64_t range_length;
+    size_t jobs;
+    char *media_type_pattern;
+    bool use_regex;
+    bool force;
+    char **extra_paths;
+    size_t extra_path_count;
+
+    // set for batch jobs, which run concurrently: their output is collected here instead of going to stdout/stderr
+    FILE *capture_stream;
 } arp_cmd_args_t;
 
 char *parse_args(int argc, char **argv, arp_cmd_args_t *out_args);
+
+char *validate_args(const arp_cmd_args_t *args);
+
+void free_args(arp_cmd_args_t *args);
@@ -14,3 +14,5 @@
 #include "arg_parse.h"
 
 char *get_output_path(const arp_cmd_args_t *args, bool *malloced);
+
+int get_compression_magic(const char *compression, char **out_magic);
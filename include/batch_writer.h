@@ -0,0 +1,30 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include "arp/unpack/types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFAULT_QUEUE_DEPTH 64
+#define MAX_QUEUE_DEPTH 4096
+
+typedef struct ArpBatchWriter arp_batch_writer_t;
+
+int batch_writer_create(size_t queue_depth, arp_batch_writer_t **out_writer);
+
+int batch_writer_add(arp_batch_writer_t *writer, const arp_resource_listing_t *listing, const char *output_root);
+
+int batch_writer_flush(arp_batch_writer_t *writer);
+
+void batch_writer_get_progress(const arp_batch_writer_t *writer, uint64_t *out_files, uint64_t *out_bytes);
+
+void batch_writer_free(arp_batch_writer_t *writer);
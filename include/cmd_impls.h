@@ -11,10 +11,20 @@
 
 #include "arg_parse.h"
 
+int exec_cmd(arp_cmd_args_t *args);
+
 int exec_cmd_pack(arp_cmd_args_t *args);
 
 int exec_cmd_unpack(arp_cmd_args_t *args);
 
 int exec_cmd_list(arp_cmd_args_t *args);
 
+int exec_cmd_watch(arp_cmd_args_t *args);
+
+int exec_cmd_batch(arp_cmd_args_t *args);
+
+int exec_cmd_recompress(arp_cmd_args_t *args);
+
+int exec_cmd_find(arp_cmd_args_t *args);
+
 int exec_cmd_help(arp_cmd_args_t *args);
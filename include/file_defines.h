@@ -23,4 +23,6 @@
 
 #define EXTENSION_DELIM '.'
 
+#define PACKAGE_EXTENSION ".arp"
+
 extern int make_iso_compilers_happy;
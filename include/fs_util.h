@@ -0,0 +1,39 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// identifies a version of a file's contents closely enough to tell when something derived from it has gone stale
+typedef struct ArpFileStamp {
+    uint64_t size;
+    int64_t mtime_sec;
+    // zero where the platform only records whole seconds
+    int64_t mtime_nsec;
+} arp_file_stamp_t;
+
+typedef int (*walk_callback_t)(const char *path, bool is_dir, uint64_t size, void *user_data);
+
+int mkdirs(const char *path);
+
+// like mkdirs, but assumes root already exists and only creates the components of path that lie below it
+int mkdirs_below(const char *root, const char *path);
+
+int walk_dir(const char *root, walk_callback_t callback, void *user_data);
+
+// like walk_dir, but only visits the immediate entries of root without descending into subdirectories
+int list_dir(const char *root, walk_callback_t callback, void *user_data);
+
+int remove_tree(const char *root);
+
+int sync_file(const char *path);
+
+int get_file_stamp(const char *path, arp_file_stamp_t *out_stamp);
@@ -0,0 +1,45 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include "arp/unpack/types.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define INDEX_FILE_SUFFIX ".idx"
+
+typedef struct ArpPathIndex {
+    const unsigned char *data;
+    size_t data_len;
+    bool mapped;
+} arp_path_index_t;
+
+typedef struct ArpPathIndexEntry {
+    const char *path;
+    size_t path_len;
+    const char *media_type;
+    size_t media_type_len;
+} arp_path_index_entry_t;
+
+char *get_index_path(const char *package_path);
+
+int write_path_index(ConstArpPackage package, const char *package_path);
+
+int open_path_index(const char *package_path, arp_path_index_t *out_index);
+
+void close_path_index(arp_path_index_t *index);
+
+size_t get_path_index_entry_count(const arp_path_index_t *index);
+
+bool get_path_index_entry(const arp_path_index_t *index, size_t entry_index, arp_path_index_entry_t *out_entry);
+
+bool find_in_path_index(const arp_path_index_t *index, const char *path, arp_path_index_entry_t *out_entry);
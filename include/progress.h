@@ -0,0 +1,32 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include "arg_parse.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct ArpProgress {
+    bool enabled;
+    bool json;
+    uint64_t total_files;
+    uint64_t total_bytes;
+    uint64_t done_files;
+    uint64_t done_bytes;
+    double start_time;
+    double next_render_time;
+} arp_progress_t;
+
+void progress_init(arp_progress_t *progress, const arp_cmd_args_t *args, uint64_t total_files, uint64_t total_bytes);
+
+void progress_update(arp_progress_t *progress, uint64_t files, uint64_t bytes);
+
+void progress_finish(arp_progress_t *progress);
@@ -0,0 +1,18 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+typedef void (*pool_task_fn_t)(size_t task_index, void *user_data);
+
+size_t get_cpu_count(void);
+
+int run_task_pool(size_t task_count, size_t worker_count, pool_task_fn_t task_fn, void *user_data);
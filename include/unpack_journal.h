@@ -0,0 +1,33 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define JOURNAL_FILE_SUFFIX ".journal"
+
+typedef struct ArpUnpackJournal {
+    FILE *file;
+    char *path;
+    char *contents;
+    char **completed;
+    size_t completed_count;
+    size_t unsynced_count;
+} arp_unpack_journal_t;
+
+int open_unpack_journal(const char *output_root, const char *package_path, arp_unpack_journal_t *out_journal);
+
+bool is_resource_journaled(const arp_unpack_journal_t *journal, const char *res_path);
+
+int journal_resource(arp_unpack_journal_t *journal, const char *res_path);
+
+int close_unpack_journal(arp_unpack_journal_t *journal, bool discard);
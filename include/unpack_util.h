@@ -0,0 +1,45 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#pragma once
+
+#include "arena.h"
+
+#include "arp/unpack/types.h"
+
+#include <stdint.h>
+
+// passed as a range length to extract everything from the offset onward
+#define RANGE_LEN_TO_END UINT64_MAX
+
+// remembers the last directory created under an output root, since listings come grouped by directory
+typedef struct ArpOutputDirCache {
+    arp_arena_t arena;
+    char *last_dir;
+} arp_output_dir_cache_t;
+
+void output_dir_cache_init(arp_output_dir_cache_t *cache);
+
+void output_dir_cache_free(arp_output_dir_cache_t *cache);
+
+// creates out_dir below the (already existing) output root, doing nothing if the cache says it was the last one made
+int ensure_output_dir(arp_output_dir_cache_t *cache, const char *output_root, const char *out_dir);
+
+char *get_resource_output_dir(arp_arena_t *arena, const char *output_root, const char *res_path);
+
+char *get_resource_output_file(arp_arena_t *arena, const char *output_dir, const arp_resource_meta_t *meta);
+
+// the output root must already exist. dir_cache may be null if the caller can't keep one around.
+int unpack_listing_to_fs(const arp_resource_listing_t *listing, const char *output_root,
+        arp_output_dir_cache_t *dir_cache);
+
+// writes the range to a file named for it alongside where the full resource would go. if out_file_path is non-null,
+// it receives a copy of the written file's path, which the caller must free.
+int unpack_resource_range_to_fs(const arp_resource_meta_t *meta, const char *output_dir, uint64_t offset,
+        uint64_t length, char **out_file_path);
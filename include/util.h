@@ -13,9 +13,17 @@
 
 #include "stdio.h"
 
+#include <stdbool.h>
+
 enum LogLevel {
     LogLevelInfo,
     LogLevelError
 };
 
 void arptool_print(const arp_cmd_args_t *cmd_args, enum LogLevel level, const char *fmt, ...);
+
+double get_monotonic_secs(void);
+
+const char *get_libarp_error(const arp_cmd_args_t *cmd_args, int rc);
+
+bool match_glob(const char *pattern, const char *str);
@@ -0,0 +1,193 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arena.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#ifndef __STDC_NO_ATOMICS__
+#include <stdatomic.h>
+typedef atomic_ullong stat_counter_t;
+#define STAT_LOAD(counter) atomic_load(&(counter))
+#define STAT_ADD(counter, val) atomic_fetch_add(&(counter), (val))
+#define STAT_SUB(counter, val) atomic_fetch_sub(&(counter), (val))
+#else
+// without atomics the counters may drift slightly under contention, which is acceptable for diagnostics
+typedef unsigned long long stat_counter_t;
+#define STAT_LOAD(counter) (counter)
+#define STAT_ADD(counter, val) ((counter) += (val), (counter) - (val))
+#define STAT_SUB(counter, val) ((counter) -= (val), (counter) + (val))
+#endif
+
+#define ALIGN_UP(n, align) (((n) + (align) - 1) & ~((size_t) (align) - 1))
+
+struct ArpArenaBlock {
+    arp_arena_block_t *next;
+    size_t len;
+    _Alignas(max_align_t) unsigned char data[];
+};
+
+static stat_counter_t g_arena_allocs;
+static stat_counter_t g_arena_blocks;
+static stat_counter_t g_live_bytes;
+static stat_counter_t g_peak_bytes;
+
+static void _note_block_alloc(size_t len) {
+    unsigned long long live = STAT_ADD(g_live_bytes, len) + len;
+    STAT_ADD(g_arena_blocks, 1);
+
+    #ifndef __STDC_NO_ATOMICS__
+    unsigned long long peak = atomic_load(&g_peak_bytes);
+    while (live > peak && !atomic_compare_exchange_weak(&g_peak_bytes, &peak, live)) {
+        // peak is refreshed by the failed exchange
+    }
+    #else
+    if (live > g_peak_bytes) {
+        g_peak_bytes = live;
+    }
+    #endif
+}
+
+static void _free_blocks(arp_arena_block_t *block) {
+    while (block != NULL) {
+        arp_arena_block_t *next = block->next;
+        STAT_SUB(g_live_bytes, block->len);
+        free(block);
+        block = next;
+    }
+}
+
+static void _flush_alloc_count(arp_arena_t *arena) {
+    STAT_ADD(g_arena_allocs, arena->alloc_count);
+    arena->alloc_count = 0;
+}
+
+void arena_init(arp_arena_t *arena, void *initial_buf, size_t initial_len, size_t block_len) {
+    memset(arena, 0, sizeof(arp_arena_t));
+
+    arena->initial_buf = initial_buf;
+    arena->initial_len = initial_buf != NULL ? initial_len : 0;
+    arena->block_len = block_len > 0 ? block_len : ARENA_DEFAULT_BLOCK_LEN;
+    arena->cur = arena->initial_buf;
+    arena->cur_len = arena->initial_len;
+}
+
+void *arena_alloc(arp_arena_t *arena, size_t len) {
+    size_t align = _Alignof(max_align_t);
+
+    // the initial buffer may not be maximally aligned, so alignment is computed against real addresses
+    size_t offset = 0;
+    if (arena->cur != NULL) {
+        uintptr_t base = (uintptr_t) arena->cur;
+        offset = (size_t) (ALIGN_UP(base + arena->cur_used, align) - base);
+    }
+
+    if (arena->cur == NULL || offset > arena->cur_len || len > arena->cur_len - offset) {
+        size_t block_len = len > arena->block_len ? len : arena->block_len;
+
+        arp_arena_block_t *block = NULL;
+        if ((block = malloc(sizeof(arp_arena_block_t) + block_len)) == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        _note_block_alloc(block_len);
+
+        block->len = block_len;
+        block->next = arena->blocks;
+        arena->blocks = block;
+
+        arena->cur = block->data;
+        arena->cur_len = block_len;
+        arena->cur_used = 0;
+        offset = 0;
+    }
+
+    void *ptr = arena->cur + offset;
+    arena->cur_used = offset + len;
+    arena->alloc_count += 1;
+
+    return ptr;
+}
+
+char *arena_strdup(arp_arena_t *arena, const char *str) {
+    size_t len = strlen(str);
+
+    char *copy = NULL;
+    if ((copy = arena_alloc(arena, len + 1)) == NULL) {
+        return NULL;
+    }
+    memcpy(copy, str, len + 1);
+
+    return copy;
+}
+
+void arena_reset(arp_arena_t *arena) {
+    _flush_alloc_count(arena);
+
+    // hang on to the newest block so that an arena reused in a loop doesn't go back to the heap every iteration
+    arp_arena_block_t *keep = arena->blocks;
+    if (keep != NULL) {
+        _free_blocks(keep->next);
+        keep->next = NULL;
+
+        arena->cur = keep->data;
+        arena->cur_len = keep->len;
+    } else {
+        arena->cur = arena->initial_buf;
+        arena->cur_len = arena->initial_len;
+    }
+
+    arena->cur_used = 0;
+}
+
+void arena_free(arp_arena_t *arena) {
+    _flush_alloc_count(arena);
+
+    _free_blocks(arena->blocks);
+
+    arena->blocks = NULL;
+    arena->cur = arena->initial_buf;
+    arena->cur_len = arena->initial_len;
+    arena->cur_used = 0;
+}
+
+void get_alloc_stats(arp_alloc_stats_t *out_stats) {
+    out_stats->arena_allocs = STAT_LOAD(g_arena_allocs);
+    out_stats->arena_blocks = STAT_LOAD(g_arena_blocks);
+    out_stats->peak_arena_block_bytes = STAT_LOAD(g_peak_bytes);
+
+    out_stats->peak_rss_bytes = 0;
+    #ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        out_stats->peak_rss_bytes = counters.PeakWorkingSetSize;
+    }
+    #else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        #ifdef __APPLE__
+        out_stats->peak_rss_bytes = (uint64_t) usage.ru_maxrss;
+        #else
+        out_stats->peak_rss_bytes = (uint64_t) usage.ru_maxrss * 1024;
+        #endif
+    }
+    #endif
+}
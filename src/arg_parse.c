@@ -9,8 +9,11 @@
 
 #include "arg_defs.h"
 #include "arg_parse.h"
+#include "batch_writer.h"
 #include "compression_defines.h"
 
+#include "arp/util/defines.h"
+
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -23,6 +26,8 @@
 
 #define ERR_MSG_BUF_LEN 256
 
+#define RANGE_DELIM ':'
+
 #define CMP_LONG_FLAG(arg, len, flag) (strncmp(arg, flag, len) == 0 && strlen(flag) == (len))
 
 static char *_parse_failed(const char *format, ...) {
@@ -37,6 +42,28 @@ static char *_parse_failed(const char *format, ...) {
     return _cpp_err_msg_buf;
 }
 
+static bool _parse_range(const char *param, uint64_t *out_offset, uint64_t *out_length) {
+    char *end = NULL;
+
+    errno = 0;
+    *out_offset = strtoull(param, &end, BASE_10);
+    if (errno != 0 || end == param) {
+        return false;
+    }
+
+    // the length may be omitted entirely to request everything from the offset onward
+    if (*end == '\0' || (*end == RANGE_DELIM && *(end + 1) == '\0')) {
+        *out_length = UINT64_MAX;
+        return true;
+    } else if (*end != RANGE_DELIM) {
+        return false;
+    }
+
+    const char *len_str = end + 1;
+    *out_length = strtoull(len_str, &end, BASE_10);
+    return errno == 0 && end != len_str && *end == '\0';
+}
+
 char *parse_args(int argc, char **argv, arp_cmd_args_t *out_args) {
     size_t pos = 0;
     bool stopped_args = false;
@@ -90,6 +117,55 @@ char *parse_args(int argc, char **argv, arp_cmd_args_t *out_args) {
 
                     out_args->compression = CMPR_STR_DEFLATE;
                     continue;
+                } else if (CMP_LONG_FLAG(flag, flag_len, NFLAG_INDEX)) {
+                    if (eq_pos != NULL) {
+                        return _parse_failed("Argument '%s' must not have a parameter", arg);
+                    }
+
+                    out_args->build_index = true;
+                    continue;
+                } else if (CMP_LONG_FLAG(flag, flag_len, NFLAG_REGEX)) {
+                    if (eq_pos != NULL) {
+                        return _parse_failed("Argument '%s' must not have a parameter", arg);
+                    }
+
+                    out_args->use_regex = true;
+                    continue;
+                } else if (CMP_LONG_FLAG(flag, flag_len, NFLAG_PLAN)) {
+                    if (eq_pos != NULL) {
+                        return _parse_failed("Argument '%s' must not have a parameter", arg);
+                    }
+
+                    out_args->plan_only = true;
+                    continue;
+                } else if (CMP_LONG_FLAG(flag, flag_len, NFLAG_RESUME)) {
+                    if (eq_pos != NULL) {
+                        return _parse_failed("Argument '%s' must not have a parameter", arg);
+                    }
+
+                    out_args->resume = true;
+                    continue;
+                } else if (CMP_LONG_FLAG(flag, flag_len, NFLAG_IO_URING)) {
+                    if (eq_pos != NULL) {
+                        return _parse_failed("Argument '%s' must not have a parameter", arg);
+                    }
+
+                    out_args->use_io_uring = true;
+                    continue;
+                } else if (CMP_LONG_FLAG(flag, flag_len, NFLAG_PROGRESS)) {
+                    if (eq_pos != NULL) {
+                        return _parse_failed("Argument '%s' must not have a parameter", arg);
+                    }
+
+                    out_args->show_progress = true;
+                    continue;
+                } else if (CMP_LONG_FLAG(flag, flag_len, NFLAG_FORCE)) {
+                    if (eq_pos != NULL) {
+                        return _parse_failed("Argument '%s' must not have a parameter", arg);
+                    }
+
+                    out_args->force = true;
+                    continue;
                 }
 
                 char *param;
@@ -130,6 +206,34 @@ char *parse_args(int argc, char **argv, arp_cmd_args_t *out_args) {
                     out_args->part_size = param_l;
                 } else if (CMP_LONG_FLAG(flag, flag_len, FLAG_RESOURCE_PATH_LONG)) {
                     out_args->resource_path = param;
+                } else if (CMP_LONG_FLAG(flag, flag_len, FLAG_JOBS_LONG)) {
+                    errno = 0;
+                    uint64_t param_l = strtoull(param, NULL, BASE_10);
+
+                    if (errno != 0 || param_l == 0) {
+                        return _parse_failed("Invalid param '%s' for flag '%s'", param, arg);
+                    }
+
+                    out_args->jobs = (size_t) param_l;
+                } else if (CMP_LONG_FLAG(flag, flag_len, FLAG_QUEUE_DEPTH_LONG)) {
+                    errno = 0;
+                    uint64_t param_l = strtoull(param, NULL, BASE_10);
+
+                    if (errno != 0 || param_l == 0 || param_l > MAX_QUEUE_DEPTH) {
+                        return _parse_failed("Invalid param '%s' for flag '%s'", param, arg);
+                    }
+
+                    out_args->queue_depth = (size_t) param_l;
+                } else if (CMP_LONG_FLAG(flag, flag_len, FLAG_MEDIA_TYPE_LONG)) {
+                    out_args->media_type_pattern = param;
+                } else if (CMP_LONG_FLAG(flag, flag_len, FLAG_RANGE_LONG)) {
+                    if (!_parse_range(param, &out_args->range_offset, &out_args->range_length)) {
+                        return _parse_failed("Invalid param '%s' for flag '%s'", param, arg);
+                    }
+
+                    out_args->has_range = true;
+                } else if (CMP_LONG_FLAG(flag, flag_len, FLAG_RECORD_ACCESS_LONG)) {
+                    out_args->access_log_path = param;
                 } else {
                     return _parse_failed("Unrecognized flag '%s'", arg);
                 }
@@ -191,6 +295,15 @@ char *parse_args(int argc, char **argv, arp_cmd_args_t *out_args) {
                         out_args->part_size = param_l;
                     } else if (flag == FLAG_RESOURCE_PATH_SHORT) {
                         out_args->resource_path = param;
+                    } else if (flag == FLAG_JOBS_SHORT) {
+                        errno = 0;
+                        uint64_t param_l = strtoull(param, NULL, BASE_10);
+
+                        if (errno != 0 || param_l == 0) {
+                            return _parse_failed("Invalid param '%s' for flag '%s'", param, arg);
+                        }
+
+                        out_args->jobs = (size_t) param_l;
                     } else {
                         return _parse_failed("Unrecognized flag '%s'", arg);
                     }
@@ -211,7 +324,15 @@ char *parse_args(int argc, char **argv, arp_cmd_args_t *out_args) {
                 break;
             }
             default: {
-                return _parse_failed("Found unexpected positional arg '%s'", arg);
+                // only the find verb accepts more than one input, but we can't know the verb for certain until
+                // parsing is done, so extra inputs are collected here and rejected by validate_args if necessary
+                if (out_args->extra_paths == NULL
+                        && (out_args->extra_paths = calloc((size_t) argc, sizeof(char *))) == NULL) {
+                    return _parse_failed("Out of memory");
+                }
+
+                out_args->extra_paths[out_args->extra_path_count++] = arg;
+                break;
             }
         }
 
@@ -232,3 +353,102 @@ char *parse_args(int argc, char **argv, arp_cmd_args_t *out_args) {
 
     return NULL;
 }
+
+char *validate_args(const arp_cmd_args_t *args) {
+    if (args->verb != NULL && strcmp(args->verb, VERB_PACK) != 0 && strcmp(args->verb, VERB_WATCH) != 0) {
+        if (args->mappings_path != NULL) {
+            return _parse_failed("Mappings path param does not make sense with specified verb");
+        }
+        if (args->build_index) {
+            return _parse_failed("Index flag does not make sense with specified verb");
+        }
+    }
+
+    if (args->verb != NULL && strcmp(args->verb, VERB_PACK) != 0 && strcmp(args->verb, VERB_WATCH) != 0
+            && strcmp(args->verb, VERB_RECOMPRESS) != 0) {
+        if (args->compression != NULL) {
+            return _parse_failed("Compression param does not make sense with specified verb");
+        }
+        if (args->package_name != NULL) {
+            return _parse_failed("Package name param does not make sense with specified verb");
+        }
+        if (args->package_namespace != NULL) {
+            return _parse_failed("Namespace param does not make sense with specified verb");
+        }
+        if (args->part_size != 0) {
+            return _parse_failed("Part size param does not make sense with specified verb");
+        }
+    }
+
+    if (args->verb != NULL && strcmp(args->verb, VERB_PACK) != 0) {
+        if (args->plan_only) {
+            return _parse_failed("Plan flag does not make sense with specified verb");
+        }
+    }
+
+    if (args->verb != NULL && strcmp(args->verb, VERB_PACK) != 0 && strcmp(args->verb, VERB_UNPACK) != 0
+            && strcmp(args->verb, VERB_WATCH) != 0) {
+        if (args->show_progress) {
+            return _parse_failed("Progress flag does not make sense with specified verb");
+        }
+    }
+
+    if (args->verb != NULL && strcmp(args->verb, VERB_UNPACK) != 0) {
+        if (args->access_log_path != NULL) {
+            return _parse_failed("Access log param does not make sense with specified verb");
+        }
+        if (args->has_range) {
+            return _parse_failed("Range param does not make sense with specified verb");
+        }
+        if (args->resume) {
+            return _parse_failed("Resume flag does not make sense with specified verb");
+        }
+        if (args->use_io_uring) {
+            return _parse_failed("io_uring flag does not make sense with specified verb");
+        }
+        if (args->queue_depth != 0) {
+            return _parse_failed("Queue depth param does not make sense with specified verb");
+        }
+    }
+
+    if (args->queue_depth != 0 && !args->use_io_uring) {
+        return _parse_failed("Queue depth param requires the io_uring flag");
+    }
+
+    if (args->verb != NULL && strcmp(args->verb, VERB_BATCH) != 0 && strcmp(args->verb, VERB_RECOMPRESS) != 0
+            && strcmp(args->verb, VERB_FIND) != 0) {
+        if (args->jobs != 0) {
+            return _parse_failed("Jobs param does not make sense with specified verb");
+        }
+    }
+
+    if (args->verb != NULL && strcmp(args->verb, VERB_RECOMPRESS) != 0) {
+        if (args->force) {
+            return _parse_failed("Force flag does not make sense with specified verb");
+        }
+    }
+
+    if (args->verb != NULL && strcmp(args->verb, VERB_FIND) != 0) {
+        if (args->extra_path_count > 0) {
+            return _parse_failed("Found unexpected positional arg '%s'", args->extra_paths[0]);
+        }
+        if (args->media_type_pattern != NULL) {
+            return _parse_failed("Media type param does not make sense with specified verb");
+        }
+        if (args->use_regex) {
+            return _parse_failed("Regex flag does not make sense with specified verb");
+        }
+    }
+
+    if (args->package_namespace != NULL && strlen(args->package_namespace) > ARP_NAMESPACE_MAX) {
+        return _parse_failed("Namespace is too long (max %d chars)", ARP_NAMESPACE_MAX);
+    }
+
+    return NULL;
+}
+
+void free_args(arp_cmd_args_t *args) {
+    free(args->extra_paths);
+    args->extra_paths = NULL;
+    args->extra_path_count = 0;
+}
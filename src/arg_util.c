@@ -9,10 +9,14 @@
 
 #include "arg_parse.h"
 #include "arg_util.h"
+#include "compression_defines.h"
+
+#include "arp/util/defines.h"
 
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -43,3 +47,15 @@ char *get_output_path(const arp_cmd_args_t *args, bool *malloced) {
         #endif
     }
 }
+
+int get_compression_magic(const char *compression, char **out_magic) {
+    if (compression == NULL || strcmp(compression, CMPR_STR_NONE) == 0) {
+        *out_magic = NULL;
+        return 0;
+    } else if (strcmp(compression, CMPR_STR_DEFLATE) == 0) {
+        *out_magic = ARP_COMPRESS_TYPE_DEFLATE;
+        return 0;
+    } else {
+        return EINVAL;
+    }
+}
@@ -0,0 +1,569 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#if defined(__linux__) && defined(ARPTOOL_IO_URING)
+// glibc doesn't wrap the io_uring calls, so they have to go through syscall(2)
+#define _GNU_SOURCE
+#endif
+
+#include "batch_writer.h"
+
+#include <errno.h>
+
+#if defined(__linux__) && defined(ARPTOOL_IO_URING)
+#include "arena.h"
+#include "unpack_util.h"
+
+#include "arp/unpack/resource.h"
+#include "arp/unpack/unpack.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+// each file needs at most a fallocate, a write, and a close in flight at once
+#define SQES_PER_FILE 3
+
+// resources above this size are left to libarp, which streams them rather than holding them in memory
+#define MAX_BATCHED_RESOURCE_LEN (16 * 1024 * 1024)
+// caps the memory held by loaded resources waiting to be written
+#define MAX_PENDING_BYTES (64 * 1024 * 1024)
+// resources at least this large are preallocated so the filesystem can lay them out contiguously
+#define FALLOCATE_MIN_LEN (1024 * 1024)
+
+#define OUTPUT_FILE_MODE 0644
+
+#define OP_FALLOCATE 0
+#define OP_WRITE 1
+#define OP_CLOSE 2
+#define OP_SHIFT 2
+#define OP_MASK 3
+
+typedef struct Uring {
+    int fd;
+    void *sq_ptr;
+    size_t sq_ptr_len;
+    void *cq_ptr;
+    size_t cq_ptr_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned int local_tail;
+    // set once io_uring_enter fails outright, after which the ring may still hold entries that were never submitted
+    bool failed;
+    // set if entries may still be in flight after a failure, so the memory and descriptors they use can't be released
+    bool lost;
+} uring_t;
+
+typedef struct PendingWrite {
+    arp_resource_t *resource;
+    char *path;
+    int fd;
+    int rc;
+} pending_write_t;
+
+struct ArpBatchWriter {
+    uring_t ring;
+    size_t queue_depth;
+    pending_write_t *pending;
+    size_t pending_count;
+    uint64_t pending_bytes;
+    // holds the paths of pending writes and is rewound after every flush
+    arp_arena_t path_arena;
+    arp_output_dir_cache_t dir_cache;
+    uint64_t done_files;
+    uint64_t done_bytes;
+};
+
+static int _uring_setup(unsigned int entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int _uring_enter(int fd, unsigned int to_submit, unsigned int min_complete) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static int _uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void _uring_destroy(uring_t *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_ptr_len);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_ptr_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+// checks that the kernel knows about every operation we need, since older ones only support plain reads and writes
+static bool _uring_supports_ops(int fd) {
+    size_t probe_len = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = NULL;
+    if ((probe = calloc(1, probe_len)) == NULL) {
+        return false;
+    }
+
+    bool supported = false;
+    if (_uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+        const int required_ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_FALLOCATE };
+        supported = true;
+        for (size_t i = 0; i < sizeof(required_ops) / sizeof(required_ops[0]); i++) {
+            int op = required_ops[i];
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                supported = false;
+            }
+        }
+    }
+
+    free(probe);
+    return supported;
+}
+
+static int _uring_init(uring_t *ring, unsigned int entries) {
+    memset(ring, 0, sizeof(uring_t));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    // setup fails outright on kernels without io_uring or where it's been disabled (e.g. by seccomp)
+    if ((ring->fd = _uring_setup(entries, &params)) < 0) {
+        ring->fd = -1;
+        return ENOTSUP;
+    }
+
+    if (!_uring_supports_ops(ring->fd)) {
+        _uring_destroy(ring);
+        return ENOTSUP;
+    }
+
+    ring->sq_ptr_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ptr_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_ptr_len = MAX(ring->sq_ptr_len, ring->cq_ptr_len);
+        ring->cq_ptr_len = ring->sq_ptr_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_ptr_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+            IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        _uring_destroy(ring);
+        return ENOTSUP;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_ptr_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            _uring_destroy(ring);
+            return ENOTSUP;
+        }
+    }
+
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+            IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        _uring_destroy(ring);
+        return ENOTSUP;
+    }
+
+    char *sq_base = ring->sq_ptr;
+    char *cq_base = ring->cq_ptr;
+    ring->sq_head = (unsigned int *) (sq_base + params.sq_off.head);
+    ring->sq_tail = (unsigned int *) (sq_base + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *) (sq_base + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sq_base + params.sq_off.array);
+    ring->cq_head = (unsigned int *) (cq_base + params.cq_off.head);
+    ring->cq_tail = (unsigned int *) (cq_base + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *) (cq_base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq_base + params.cq_off.cqes);
+    ring->local_tail = *ring->sq_tail;
+
+    return 0;
+}
+
+// callers never queue more than a ring's worth of entries between waits, so a slot is always available
+static struct io_uring_sqe *_uring_get_sqe(uring_t *ring) {
+    unsigned int index = ring->local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    ring->sq_array[index] = index;
+    ring->local_tail += 1;
+
+    return sqe;
+}
+
+// submits everything queued and blocks until the given number of completions have been handled. if the ring fails
+// partway, everything the kernel already accepted is still waited for, since it may reference the caller's buffers.
+static int _uring_submit_and_reap(uring_t *ring, unsigned int expected, void (*handler)(const struct io_uring_cqe *,
+        void *), void *user_data) {
+    unsigned int start_head = atomic_load_explicit((_Atomic unsigned int *) ring->sq_head, memory_order_acquire);
+    atomic_store_explicit((_Atomic unsigned int *) ring->sq_tail, ring->local_tail, memory_order_release);
+
+    int rc = 0;
+    unsigned int reaped = 0;
+    while (reaped < expected) {
+        unsigned int sq_head = atomic_load_explicit((_Atomic unsigned int *) ring->sq_head, memory_order_acquire);
+        unsigned int in_flight = (sq_head - start_head) - reaped;
+
+        unsigned int to_submit = ring->local_tail - sq_head;
+        unsigned int min_complete = expected - reaped;
+        if (rc != 0) {
+            if (in_flight == 0) {
+                break;
+            }
+
+            // nothing more is submitted after a failure, we only wait for what's already out
+            to_submit = 0;
+            min_complete = in_flight;
+        }
+
+        if (_uring_enter(ring->fd, to_submit, min_complete) < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                // these only mean the kernel wants completions reaped before it takes more, so reap and retry
+            } else if (rc == 0) {
+                rc = errno;
+                ring->failed = true;
+            } else {
+                // there's no way left to tell when the kernel is done with what it was given
+                ring->lost = true;
+                return rc;
+            }
+        }
+
+        unsigned int head = *ring->cq_head;
+        unsigned int tail = atomic_load_explicit((_Atomic unsigned int *) ring->cq_tail, memory_order_acquire);
+        while (head != tail) {
+            handler(&ring->cqes[head & *ring->cq_mask], user_data);
+            head += 1;
+            reaped += 1;
+        }
+
+        atomic_store_explicit((_Atomic unsigned int *) ring->cq_head, head, memory_order_release);
+    }
+
+    return rc;
+}
+
+static int _write_file_sync(const char *path, const void *data, size_t len) {
+    FILE *file = NULL;
+    if ((file = fopen(path, "wb")) == NULL) {
+        return errno;
+    }
+
+    int rc = 0;
+    if (len > 0 && fwrite(data, 1, len, file) != len) {
+        rc = EIO;
+    }
+
+    if (fclose(file) != 0 && rc == 0) {
+        rc = errno;
+    }
+
+    return rc;
+}
+
+static void _handle_open(const struct io_uring_cqe *cqe, void *user_data) {
+    pending_write_t *entry = &((arp_batch_writer_t *) user_data)->pending[cqe->user_data];
+    if (cqe->res >= 0) {
+        entry->fd = cqe->res;
+    } else {
+        entry->rc = -cqe->res;
+    }
+}
+
+static void _handle_write(const struct io_uring_cqe *cqe, void *user_data) {
+    pending_write_t *entry = &((arp_batch_writer_t *) user_data)->pending[cqe->user_data >> OP_SHIFT];
+    switch (cqe->user_data & OP_MASK) {
+        case OP_FALLOCATE:
+            // preallocation is only a hint, and not every filesystem supports it
+            break;
+        case OP_WRITE:
+            if (cqe->res < 0) {
+                entry->rc = -cqe->res;
+            } else if ((size_t) cqe->res != entry->resource->meta.size) {
+                entry->rc = EIO;
+            }
+            break;
+        case OP_CLOSE:
+            if (cqe->res < 0 && entry->rc == 0) {
+                entry->rc = -cqe->res;
+            }
+            entry->fd = -1;
+            break;
+        default:
+            break;
+    }
+}
+
+static void _release_pending(arp_batch_writer_t *writer) {
+    // leaking is the only safe option if the kernel might still write from these buffers or to these descriptors
+    if (writer->ring.lost) {
+        writer->pending_count = 0;
+        writer->pending_bytes = 0;
+        return;
+    }
+
+    for (size_t i = 0; i < writer->pending_count; i++) {
+        // only still set if the ring failed before the close could complete
+        if (writer->pending[i].fd >= 0) {
+            close(writer->pending[i].fd);
+        }
+        arp_unload_resource(writer->pending[i].resource);
+    }
+
+    arena_reset(&writer->path_arena);
+
+    writer->pending_count = 0;
+    writer->pending_bytes = 0;
+}
+
+int batch_writer_flush(arp_batch_writer_t *writer) {
+    if (writer->pending_count == 0) {
+        return 0;
+    }
+
+    uring_t *ring = &writer->ring;
+
+    // the ring may still hold entries that were queued but never submitted, so it can't be reused
+    if (ring->failed) {
+        _release_pending(writer);
+        return EIO;
+    }
+
+    // files can't be written until we know their descriptors, so opens are batched separately from everything else
+    for (size_t i = 0; i < writer->pending_count; i++) {
+        struct io_uring_sqe *sqe = _uring_get_sqe(ring);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t) (uintptr_t) writer->pending[i].path;
+        sqe->len = OUTPUT_FILE_MODE;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        sqe->user_data = i;
+    }
+
+    int rc = 0;
+    if ((rc = _uring_submit_and_reap(ring, (unsigned int) writer->pending_count, _handle_open, writer)) != 0) {
+        _release_pending(writer);
+        return rc;
+    }
+
+    unsigned int expected = 0;
+    for (size_t i = 0; i < writer->pending_count; i++) {
+        pending_write_t *entry = &writer->pending[i];
+        if (entry->fd < 0) {
+            continue;
+        }
+
+        size_t len = entry->resource->meta.size;
+
+        // hard links keep the chain going if an earlier step fails, so the descriptor is always closed
+        if (len >= FALLOCATE_MIN_LEN) {
+            struct io_uring_sqe *sqe = _uring_get_sqe(ring);
+            sqe->opcode = IORING_OP_FALLOCATE;
+            sqe->flags = IOSQE_IO_HARDLINK;
+            sqe->fd = entry->fd;
+            sqe->addr = len;
+            sqe->user_data = (i << OP_SHIFT) | OP_FALLOCATE;
+            expected += 1;
+        }
+
+        if (len > 0) {
+            struct io_uring_sqe *sqe = _uring_get_sqe(ring);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->flags = IOSQE_IO_HARDLINK;
+            sqe->fd = entry->fd;
+            sqe->addr = (uint64_t) (uintptr_t) entry->resource->data;
+            sqe->len = (unsigned int) len;
+            sqe->user_data = (i << OP_SHIFT) | OP_WRITE;
+            expected += 1;
+        }
+
+        struct io_uring_sqe *sqe = _uring_get_sqe(ring);
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = entry->fd;
+        sqe->user_data = (i << OP_SHIFT) | OP_CLOSE;
+        expected += 1;
+    }
+
+    if ((rc = _uring_submit_and_reap(ring, expected, _handle_write, writer)) != 0) {
+        _release_pending(writer);
+        return rc;
+    }
+
+    for (size_t i = 0; i < writer->pending_count && rc == 0; i++) {
+        pending_write_t *entry = &writer->pending[i];
+
+        // anything that went wrong asynchronously gets one more try the slow way before we give up on it
+        if (entry->rc != 0) {
+            rc = _write_file_sync(entry->path, entry->resource->data, entry->resource->meta.size);
+        }
+
+        if (rc == 0) {
+            writer->done_files += 1;
+            writer->done_bytes += entry->resource->meta.size;
+        }
+    }
+
+    _release_pending(writer);
+
+    return rc;
+}
+
+int batch_writer_add(arp_batch_writer_t *writer, const arp_resource_listing_t *listing, const char *output_root) {
+    const arp_resource_meta_t *meta = &listing->meta;
+
+    int rc = 0;
+    if (meta->size > MAX_BATCHED_RESOURCE_LEN) {
+        if ((rc = batch_writer_flush(writer)) != 0
+                || (rc = unpack_listing_to_fs(listing, output_root, &writer->dir_cache)) != 0) {
+            return rc;
+        }
+
+        writer->done_files += 1;
+        writer->done_bytes += meta->size;
+        return 0;
+    }
+
+    if (writer->ring.failed) {
+        return EIO;
+    }
+
+    // the directory string is left behind in the path arena, which is cheaper than giving it its own allocation
+    char *out_dir = NULL;
+    char *out_file_path = NULL;
+    if ((out_dir = get_resource_output_dir(&writer->path_arena, output_root, listing->path)) == NULL
+            || (out_file_path = get_resource_output_file(&writer->path_arena, out_dir, meta)) == NULL) {
+        return ENOMEM;
+    }
+
+    if ((rc = ensure_output_dir(&writer->dir_cache, output_root, out_dir)) != 0) {
+        return rc;
+    }
+
+    arp_resource_t *resource = NULL;
+    if ((resource = arp_load_resource(meta)) == NULL) {
+        return EIO;
+    }
+
+    pending_write_t *entry = &writer->pending[writer->pending_count++];
+    entry->resource = resource;
+    entry->path = out_file_path;
+    entry->fd = -1;
+    entry->rc = 0;
+    writer->pending_bytes += meta->size;
+
+    if (writer->pending_count == writer->queue_depth || writer->pending_bytes >= MAX_PENDING_BYTES) {
+        return batch_writer_flush(writer);
+    }
+
+    return 0;
+}
+
+void batch_writer_get_progress(const arp_batch_writer_t *writer, uint64_t *out_files, uint64_t *out_bytes) {
+    *out_files = writer->done_files;
+    *out_bytes = writer->done_bytes;
+}
+
+int batch_writer_create(size_t queue_depth, arp_batch_writer_t **out_writer) {
+    if (queue_depth == 0 || queue_depth > MAX_QUEUE_DEPTH) {
+        return EINVAL;
+    }
+
+    arp_batch_writer_t *writer = NULL;
+    if ((writer = calloc(1, sizeof(arp_batch_writer_t))) == NULL) {
+        return ENOMEM;
+    }
+
+    if ((writer->pending = calloc(queue_depth, sizeof(pending_write_t))) == NULL) {
+        free(writer);
+        return ENOMEM;
+    }
+
+    int rc = 0;
+    if ((rc = _uring_init(&writer->ring, (unsigned int) (queue_depth * SQES_PER_FILE))) != 0) {
+        free(writer->pending);
+        free(writer);
+        return rc;
+    }
+
+    writer->queue_depth = queue_depth;
+    arena_init(&writer->path_arena, NULL, 0, 0);
+    output_dir_cache_init(&writer->dir_cache);
+
+    *out_writer = writer;
+    return 0;
+}
+
+void batch_writer_free(arp_batch_writer_t *writer) {
+    _release_pending(writer);
+    _uring_destroy(&writer->ring);
+    arena_free(&writer->path_arena);
+    output_dir_cache_free(&writer->dir_cache);
+    free(writer->pending);
+    free(writer);
+}
+#else
+int batch_writer_create(size_t queue_depth, arp_batch_writer_t **out_writer) {
+    (void) queue_depth;
+    (void) out_writer;
+    return ENOTSUP;
+}
+
+int batch_writer_add(arp_batch_writer_t *writer, const arp_resource_listing_t *listing, const char *output_root) {
+    (void) writer;
+    (void) listing;
+    (void) output_root;
+    return ENOTSUP;
+}
+
+int batch_writer_flush(arp_batch_writer_t *writer) {
+    (void) writer;
+    return ENOTSUP;
+}
+
+void batch_writer_get_progress(const arp_batch_writer_t *writer, uint64_t *out_files, uint64_t *out_bytes) {
+    (void) writer;
+    *out_files = 0;
+    *out_bytes = 0;
+}
+
+void batch_writer_free(arp_batch_writer_t *writer) {
+    (void) writer;
+}
+#endif
@@ -0,0 +1,43 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arg_defs.h"
+#include "arg_parse.h"
+#include "cmd_impls.h"
+#include "help.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+int exec_cmd(arp_cmd_args_t *args) {
+    if (args->is_help) {
+        return exec_cmd_help(args);
+    } else if (args->verb != NULL) {
+        if (strcmp(args->verb, VERB_PACK) == 0) {
+            return exec_cmd_pack(args);
+        } else if (strcmp(args->verb, VERB_UNPACK) == 0) {
+            return exec_cmd_unpack(args);
+        } else if (strcmp(args->verb, VERB_LIST) == 0) {
+            return exec_cmd_list(args);
+        } else if (strcmp(args->verb, VERB_WATCH) == 0) {
+            return exec_cmd_watch(args);
+        } else if (strcmp(args->verb, VERB_BATCH) == 0) {
+            return exec_cmd_batch(args);
+        } else if (strcmp(args->verb, VERB_RECOMPRESS) == 0) {
+            return exec_cmd_recompress(args);
+        } else if (strcmp(args->verb, VERB_FIND) == 0) {
+            return exec_cmd_find(args);
+        }
+    }
+
+    printf("Unrecognized verb: %s\n", args->verb);
+    print_general_usage_msg();
+    return EINVAL;
+}
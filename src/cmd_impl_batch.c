@@ -0,0 +1,433 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arg_defs.h"
+#include "arg_parse.h"
+#include "cmd_impls.h"
+#include "misc_defines.h"
+#include "thread_pool.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+#define INITIAL_LINE_CAP 256
+#define INITIAL_JOB_CAP 16
+
+#define CAPTURE_COPY_LEN 4096
+#define CAPTURE_HEADER_LEN 1024
+
+#define COMMENT_CHAR '#'
+#define QUOTE_CHAR '"'
+
+// parse_args expects the program name in the first slot
+#define JOB_ARGV0 "arptool"
+
+typedef struct BatchJob {
+    char *line;
+    char **argv;
+    int argc;
+    size_t line_num;
+    arp_cmd_args_t args;
+    uint64_t cost;
+    int rc;
+    double elapsed;
+} batch_job_t;
+
+typedef struct BatchState {
+    const arp_cmd_args_t *args;
+    batch_job_t *jobs;
+    size_t *order;
+} batch_state_t;
+
+static char *_read_line(FILE *file, char **buf, size_t *cap) {
+    size_t len = 0;
+
+    while (true) {
+        if (len + 1 >= *cap) {
+            size_t new_cap = *cap > 0 ? *cap * 2 : INITIAL_LINE_CAP;
+            char *new_buf = NULL;
+            if ((new_buf = realloc(*buf, new_cap)) == NULL) {
+                errno = ENOMEM;
+                return NULL;
+            }
+            *buf = new_buf;
+            *cap = new_cap;
+        }
+
+        if (fgets(*buf + len, (int) (*cap - len), file) == NULL) {
+            return len > 0 ? *buf : NULL;
+        }
+
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n') {
+            (*buf)[len - 1] = '\0';
+            return *buf;
+        }
+    }
+}
+
+// splits a manifest line into arguments in place, honoring double quotes
+static int _tokenize_line(char *line, char ***out_argv, int *out_argc) {
+    size_t cap = 8;
+    char **argv = NULL;
+    if ((argv = malloc(cap * sizeof(char *))) == NULL) {
+        return ENOMEM;
+    }
+
+    int argc = 0;
+    argv[argc++] = JOB_ARGV0;
+
+    char *cur = line;
+    while (*cur != '\0') {
+        while (isspace((unsigned char) *cur)) {
+            cur++;
+        }
+
+        if (*cur == '\0') {
+            break;
+        }
+
+        char *token = cur;
+        char *write = cur;
+        bool quoted = false;
+        while (*cur != '\0' && (quoted || !isspace((unsigned char) *cur))) {
+            if (*cur == QUOTE_CHAR) {
+                quoted = !quoted;
+            } else {
+                *write++ = *cur;
+            }
+            cur++;
+        }
+
+        if (*cur != '\0') {
+            cur++;
+        }
+        *write = '\0';
+
+        if ((size_t) argc + 1 >= cap) {
+            cap *= 2;
+            char **new_argv = NULL;
+            if ((new_argv = realloc(argv, cap * sizeof(char *))) == NULL) {
+                free(argv);
+                return ENOMEM;
+            }
+            argv = new_argv;
+        }
+
+        argv[argc++] = token;
+    }
+
+    argv[argc] = NULL;
+
+    *out_argv = argv;
+    *out_argc = argc;
+    return 0;
+}
+
+static uint64_t _estimate_cost(const arp_cmd_args_t *job_args) {
+    // walking pack sources up front would cost a full metadata pass before any job could start, so only the root is
+    // looked at. a directory's own size grows with its entry count, which is close enough for ordering jobs.
+    struct stat src_stat;
+    if (stat(job_args->src_path, &src_stat) != 0) {
+        return 0;
+    }
+    return (uint64_t) src_stat.st_size;
+}
+
+static const char *_validate_job(const arp_cmd_args_t *job_args) {
+    if (job_args->is_help || job_args->verb == NULL || job_args->src_path == NULL) {
+        return "Expected a verb and source path";
+    }
+
+    if (strcmp(job_args->verb, VERB_PACK) != 0 && strcmp(job_args->verb, VERB_UNPACK) != 0
+            && strcmp(job_args->verb, VERB_LIST) != 0) {
+        return "Only pack, unpack, and list jobs may be batched";
+    }
+
+    if (job_args->show_progress) {
+        return "Progress flag is not supported within batch jobs";
+    }
+
+    return NULL;
+}
+
+static void _free_jobs(batch_job_t *jobs, size_t job_count) {
+    for (size_t i = 0; i < job_count; i++) {
+        free_args(&jobs[i].args);
+        free(jobs[i].argv);
+        free(jobs[i].line);
+    }
+    free(jobs);
+}
+
+static int _load_manifest(const arp_cmd_args_t *args, batch_job_t **out_jobs, size_t *out_job_count) {
+    FILE *manifest = NULL;
+    if ((manifest = fopen(args->src_path, "r")) == NULL) {
+        arptool_print(args, LogLevelError, "Failed to open manifest %s\n", args->src_path);
+        return errno;
+    }
+
+    batch_job_t *jobs = NULL;
+    size_t job_count = 0;
+    size_t job_cap = 0;
+
+    char *line_buf = NULL;
+    size_t line_cap = 0;
+    size_t line_num = 0;
+    int rc = 0;
+    char *line = NULL;
+    while (rc == 0 && (line = _read_line(manifest, &line_buf, &line_cap)) != NULL) {
+        line_num += 1;
+
+        while (isspace((unsigned char) *line)) {
+            line++;
+        }
+
+        if (*line == '\0' || *line == COMMENT_CHAR) {
+            continue;
+        }
+
+        if (job_count == job_cap) {
+            job_cap = job_cap > 0 ? job_cap * 2 : INITIAL_JOB_CAP;
+            batch_job_t *new_jobs = NULL;
+            if ((new_jobs = realloc(jobs, job_cap * sizeof(batch_job_t))) == NULL) {
+                rc = ENOMEM;
+                break;
+            }
+            jobs = new_jobs;
+        }
+
+        batch_job_t *job = &jobs[job_count];
+        memset(job, 0, sizeof(batch_job_t));
+        job->line_num = line_num;
+
+        size_t line_len = strlen(line);
+        if ((job->line = malloc(line_len + 1)) == NULL) {
+            rc = ENOMEM;
+            break;
+        }
+        memcpy(job->line, line, line_len + 1);
+        job_count += 1;
+
+        if ((rc = _tokenize_line(job->line, &job->argv, &job->argc)) != 0) {
+            break;
+        }
+
+        errno = 0;
+        char *err = parse_args(job->argc, job->argv, &job->args);
+        if (err == NULL) {
+            err = validate_args(&job->args);
+        }
+
+        if (err != NULL) {
+            arptool_print(args, LogLevelError, "Manifest line %zu: %s\n", line_num, err);
+            free(err);
+            rc = EINVAL;
+            break;
+        }
+
+        const char *job_err = NULL;
+        if ((job_err = _validate_job(&job->args)) != NULL) {
+            arptool_print(args, LogLevelError, "Manifest line %zu: %s\n", line_num, job_err);
+            rc = EINVAL;
+            break;
+        }
+
+        // jobs inherit the batch's verbosity unless they specify their own
+        if (job->args.verbosity == VerbosityNormal) {
+            job->args.verbosity = args->verbosity;
+        }
+    }
+
+    free(line_buf);
+    fclose(manifest);
+
+    if (rc != 0) {
+        _free_jobs(jobs, job_count);
+        return rc;
+    }
+
+    *out_jobs = jobs;
+    *out_job_count = job_count;
+    return 0;
+}
+
+static void _print_job_output(const arp_cmd_args_t *args, const batch_job_t *job) {
+    FILE *capture = job->args.capture_stream;
+    if (args->verbosity == VerbositySilent || fflush(capture) != 0) {
+        return;
+    }
+
+    long capture_len = ftell(capture);
+    if (capture_len <= 0) {
+        return;
+    }
+
+    rewind(capture);
+
+    FILE *out_stream = job->rc != 0 ? stderr : stdout;
+
+    char header[CAPTURE_HEADER_LEN];
+    int header_len = snprintf(header, sizeof(header), "\n==> line %zu: %s %s <==\n", job->line_num, job->args.verb,
+            job->args.src_path);
+    if (header_len < 0) {
+        return;
+    } else if ((size_t) header_len >= sizeof(header)) {
+        header_len = (int) sizeof(header) - 1;
+    }
+
+    // other jobs may be printing at the same time, so the whole block goes out in a single write when possible
+    char *block = NULL;
+    if ((block = malloc((size_t) header_len + (size_t) capture_len)) != NULL) {
+        memcpy(block, header, (size_t) header_len);
+        size_t read = fread(block + header_len, 1, (size_t) capture_len, capture);
+        fwrite(block, 1, (size_t) header_len + read, out_stream);
+        free(block);
+        return;
+    }
+
+    fwrite(header, 1, (size_t) header_len, out_stream);
+
+    char buf[CAPTURE_COPY_LEN];
+    size_t read = 0;
+    while ((read = fread(buf, 1, sizeof(buf), capture)) > 0) {
+        fwrite(buf, 1, read, out_stream);
+    }
+}
+
+static void _run_job(size_t task_index, void *user_data) {
+    batch_state_t *state = user_data;
+    batch_job_t *job = &state->jobs[state->order[task_index]];
+
+    // jobs run side by side, so each one's output is held back and printed whole once it finishes. the buffer is only
+    // opened here so that no more of them are open at once than there are workers.
+    errno = 0;
+    if ((job->args.capture_stream = tmpfile()) == NULL) {
+        job->rc = errno != 0 ? errno : EIO;
+        arptool_print(state->args, LogLevelError, "Failed to create output buffer for manifest line %zu\n",
+                job->line_num);
+        return;
+    }
+
+    double start = get_monotonic_secs();
+    job->rc = exec_cmd(&job->args);
+    job->elapsed = get_monotonic_secs() - start;
+
+    _print_job_output(state->args, job);
+
+    fclose(job->args.capture_stream);
+    job->args.capture_stream = NULL;
+}
+
+static int _compare_jobs_by_cost(const void *a, const void *b, const batch_job_t *jobs) {
+    uint64_t cost_a = jobs[*(const size_t *) a].cost;
+    uint64_t cost_b = jobs[*(const size_t *) b].cost;
+    return cost_a < cost_b ? 1 : (cost_a > cost_b ? -1 : 0);
+}
+
+static void _sort_order(size_t *order, size_t count, const batch_job_t *jobs) {
+    // insertion sort, since qsort offers no portable way to pass the job array through and manifests are small
+    for (size_t i = 1; i < count; i++) {
+        size_t cur = order[i];
+        size_t j = i;
+        while (j > 0 && _compare_jobs_by_cost(&order[j - 1], &cur, jobs) > 0) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = cur;
+    }
+}
+
+static void _print_report(const arp_cmd_args_t *args, const batch_job_t *jobs, size_t job_count, double elapsed) {
+    size_t max_verb = strlen("VERB");
+    for (size_t i = 0; i < job_count; i++) {
+        max_verb = MAX(max_verb, strlen(jobs[i].args.verb));
+    }
+
+    // the table goes to a single stream so that its rows can't be reordered when stdout and stderr are both piped
+    arptool_print(args, LogLevelInfo, "\n%-6s   %9s   %-*s   %s\n", "STATUS", "TIME", (int) max_verb, "VERB",
+            "SOURCE");
+
+    size_t failed = 0;
+    for (size_t i = 0; i < job_count; i++) {
+        const batch_job_t *job = &jobs[i];
+        if (job->rc != 0) {
+            failed += 1;
+            arptool_print(args, LogLevelInfo, "%-6s   %8.2fs   %-*s   %s (line %zu, rc: %d: %s)\n", "FAILED",
+                    job->elapsed, (int) max_verb, job->args.verb, job->args.src_path, job->line_num, job->rc,
+                    strerror(job->rc));
+        } else {
+            arptool_print(args, LogLevelInfo, "%-6s   %8.2fs   %-*s   %s\n", "OK",
+                    job->elapsed, (int) max_verb, job->args.verb, job->args.src_path);
+        }
+    }
+
+    arptool_print(args, LogLevelInfo, "%zu job(s), %zu succeeded, %zu failed in %.2fs\n",
+            job_count, job_count - failed, failed, elapsed);
+
+    if (failed > 0) {
+        arptool_print(args, LogLevelError, "%zu of %zu batch job(s) failed\n", failed, job_count);
+    }
+}
+
+int exec_cmd_batch(arp_cmd_args_t *args) {
+    batch_job_t *jobs = NULL;
+    size_t job_count = 0;
+    int rc = UNINIT_U32;
+    if ((rc = _load_manifest(args, &jobs, &job_count)) != 0) {
+        return rc;
+    }
+
+    size_t *order = NULL;
+    if ((order = calloc(job_count > 0 ? job_count : 1, sizeof(size_t))) == NULL) {
+        _free_jobs(jobs, job_count);
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < job_count; i++) {
+        jobs[i].cost = _estimate_cost(&jobs[i].args);
+        order[i] = i;
+    }
+
+    // start the most expensive jobs first so that small ones fill in around them at the end
+    _sort_order(order, job_count, jobs);
+
+    size_t worker_count = args->jobs > 0 ? args->jobs : get_cpu_count();
+
+    batch_state_t state = { .args = args, .jobs = jobs, .order = order };
+
+    double start = get_monotonic_secs();
+    rc = run_task_pool(job_count, worker_count, _run_job, &state);
+    double elapsed = get_monotonic_secs() - start;
+
+    if (rc == 0) {
+        _print_report(args, jobs, job_count, elapsed);
+
+        for (size_t i = 0; i < job_count; i++) {
+            if (jobs[i].rc != 0) {
+                rc = jobs[i].rc;
+                break;
+            }
+        }
+    }
+
+    free(order);
+    _free_jobs(jobs, job_count);
+
+    return rc;
+}
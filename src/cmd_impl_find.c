@@ -0,0 +1,178 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arg_parse.h"
+#include "cmd_impls.h"
+#include "misc_defines.h"
+#include "path_index.h"
+#include "thread_pool.h"
+#include "util.h"
+
+#include "arp/unpack/list.h"
+#include "arp/unpack/load.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <regex.h>
+#endif
+
+typedef struct FindState {
+    const arp_cmd_args_t *args;
+    #ifndef _WIN32
+    regex_t path_regex;
+    #endif
+    size_t *match_counts;
+    int *rcs;
+} find_state_t;
+
+static bool _matches(const find_state_t *state, const char *path, const char *media_type) {
+    const arp_cmd_args_t *args = state->args;
+
+    if (args->media_type_pattern != NULL && !match_glob(args->media_type_pattern, media_type)) {
+        return false;
+    }
+
+    #ifndef _WIN32
+    if (args->use_regex) {
+        return regexec(&state->path_regex, path, 0, NULL, 0) == 0;
+    }
+    #endif
+
+    return match_glob(args->src_path, path);
+}
+
+static void _report_match(const find_state_t *state, const char *package_path, const char *path,
+        const char *media_type) {
+    // each match is emitted with a single call so that lines from concurrent searches never interleave
+    arptool_print(state->args, LogLevelInfo, "%s\t%s\t%s\n", package_path, media_type, path);
+}
+
+static int _search_index(const find_state_t *state, const char *package_path, const arp_path_index_t *index,
+        size_t *out_matches) {
+    size_t entry_count = get_path_index_entry_count(index);
+    for (size_t i = 0; i < entry_count; i++) {
+        arp_path_index_entry_t entry;
+        if (!get_path_index_entry(index, i, &entry)) {
+            return EINVAL;
+        }
+
+        if (_matches(state, entry.path, entry.media_type)) {
+            _report_match(state, package_path, entry.path, entry.media_type);
+            *out_matches += 1;
+        }
+    }
+
+    return 0;
+}
+
+static int _search_package(const find_state_t *state, const char *package_path, size_t *out_matches) {
+    ArpPackage package = NULL;
+    int rc = UNINIT_U32;
+    // packages are searched concurrently and libarp's error text is process-wide, so only the code can be trusted
+    if ((rc = arp_load_from_file(package_path, NULL, &package)) != 0) {
+        arptool_print(state->args, LogLevelError, "Failed to load package %s (rc: %d: %s)\n", package_path, rc,
+                strerror(rc));
+        return rc;
+    }
+
+    arp_resource_listing_t *listings = NULL;
+    size_t listing_count = 0;
+    if ((rc = arp_get_resource_listing(package, &listings, &listing_count)) != 0) {
+        arptool_print(state->args, LogLevelError, "Failed to list resources in package %s (rc: %d: %s)\n",
+                package_path, rc, strerror(rc));
+        arp_unload(package);
+        return rc;
+    }
+
+    for (size_t i = 0; i < listing_count; i++) {
+        if (_matches(state, listings[i].path, listings[i].meta.media_type)) {
+            _report_match(state, package_path, listings[i].path, listings[i].meta.media_type);
+            *out_matches += 1;
+        }
+    }
+
+    arp_free_resource_listing(listings, listing_count);
+    arp_unload(package);
+
+    return 0;
+}
+
+static void _search_task(size_t task_index, void *user_data) {
+    find_state_t *state = user_data;
+    const char *package_path = state->args->extra_paths[task_index];
+
+    // catalogue-only search: an index lets us skip loading the package entirely
+    arp_path_index_t index;
+    if (open_path_index(package_path, &index) == 0) {
+        state->rcs[task_index] = _search_index(state, package_path, &index, &state->match_counts[task_index]);
+        close_path_index(&index);
+    } else {
+        state->rcs[task_index] = _search_package(state, package_path, &state->match_counts[task_index]);
+    }
+}
+
+int exec_cmd_find(arp_cmd_args_t *args) {
+    if (args->extra_path_count == 0) {
+        arptool_print(args, LogLevelError, "At least one package must be specified\n");
+        return EINVAL;
+    }
+
+    find_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.args = args;
+
+    if (args->use_regex) {
+        #ifdef _WIN32
+        arptool_print(args, LogLevelError, "Regex patterns are not supported on this platform\n");
+        return ENOTSUP;
+        #else
+        if (regcomp(&state.path_regex, args->src_path, REG_EXTENDED | REG_NOSUB) != 0) {
+            arptool_print(args, LogLevelError, "Invalid regex '%s'\n", args->src_path);
+            return EINVAL;
+        }
+        #endif
+    }
+
+    int rc = 0;
+    size_t package_count = args->extra_path_count;
+    if ((state.match_counts = calloc(package_count, sizeof(size_t))) == NULL
+            || (state.rcs = calloc(package_count, sizeof(int))) == NULL) {
+        rc = ENOMEM;
+    }
+
+    if (rc == 0) {
+        size_t worker_count = args->jobs > 0 ? args->jobs : get_cpu_count();
+        rc = run_task_pool(package_count, worker_count, _search_task, &state);
+    }
+
+    size_t total_matches = 0;
+    for (size_t i = 0; i < package_count && rc == 0; i++) {
+        total_matches += state.match_counts[i];
+        rc = state.rcs[i];
+    }
+
+    if (rc == 0 && total_matches == 0) {
+        rc = ENOENT;
+    }
+
+    free(state.match_counts);
+    free(state.rcs);
+
+    #ifndef _WIN32
+    if (args->use_regex) {
+        regfree(&state.path_regex);
+    }
+    #endif
+
+    return rc;
+}
@@ -25,23 +25,39 @@
 #define PACK_USAGE "arptool pack <input directory> [options]"
 #define UNPACK_USAGE "arptool unpack <input package> [options]"
 #define LIST_USAGE "arptool list <input package> [options]"
+#define WATCH_USAGE "arptool watch <input directory> [options]"
+#define BATCH_USAGE "arptool batch <manifest> [options]"
+#define RECOMPRESS_USAGE "arptool recompress <input package> --compression=<type> [options]"
+#define FIND_USAGE "arptool find <pattern> <input package>... [options]"
 
 #define VERB_PACK "pack"
 #define VERB_UNPACK "unpack"
 #define VERB_LIST "list"
+#define VERB_WATCH "watch"
+#define VERB_BATCH "batch"
+#define VERB_RECOMPRESS "recompress"
+#define VERB_FIND "find"
 
 #define DESC_PACK "Creates an ARP archive from the directory at the given input path."
 #define DESC_UNPACK "Extracts an ARP archive from the file at the given input path."
 #define DESC_LIST "Lists the contents of the ARP archive at the given input path."
+#define DESC_WATCH "Packs the directory at the given input path and repacks it whenever its contents change."
+#define DESC_RECOMPRESS "Writes a copy of the ARP archive at the given input path using a different compression type."
+#define DESC_BATCH "Runs the pack, unpack, and list jobs listed in the manifest at the given input path."
+#define DESC_FIND "Searches the given ARP archives for resources whose paths match the given pattern."
 
 #define OPT_PACK_COMPRESS_SHORT "-c <type>"
 #define OPT_PACK_COMPRESS_LONG "--compression=<type>"
-#define OPT_PACK_COMPRESS_DESC "Compression type to use. Support options are `deflate` and `none`."
+#define OPT_PACK_COMPRESS_DESC "Compression type to use. Supported options are `deflate` and `none`."
 
 #define OPT_PACK_DEFLATE_SHORT ""
 #define OPT_PACK_DEFLATE_LONG "--deflate"
 #define OPT_PACK_DEFLATE_DESC "Use DEFLATE compression. Shorthand for `-c deflate`."
 
+#define OPT_PACK_INDEX_SHORT ""
+#define OPT_PACK_INDEX_LONG "--index"
+#define OPT_PACK_INDEX_DESC "Writes a hashed path index alongside the package for faster lookups."
+
 #define OPT_PACK_NAME_SHORT "-f <name>"
 #define OPT_PACK_NAME_LONG "--name=<name>"
 #define OPT_PACK_NAME_DESC "Name to use when generating package files."
@@ -62,6 +78,37 @@
 #define OPT_PACK_PART_LONG "--part-size=<max size>"
 #define OPT_PACK_PART_DESC "Maximum size in bytes for part files. The minimum supported value is 4096 bytes."
 
+#define OPT_PACK_PLAN_SHORT ""
+#define OPT_PACK_PLAN_LONG "--plan"
+#define OPT_PACK_PLAN_DESC "Estimates output size, part count, and duration by sampling without writing anything."
+
+#define OPT_PACK_PROGRESS_SHORT ""
+#define OPT_PACK_PROGRESS_LONG "--progress"
+#define OPT_PACK_PROGRESS_DESC "Reports live progress to stderr (as JSON lines if stderr is not a terminal)."
+
+#define OPT_BATCH_JOBS_SHORT "-j <count>"
+#define OPT_BATCH_JOBS_LONG "--jobs=<count>"
+#define OPT_BATCH_JOBS_DESC "Number of jobs to run concurrently. Defaults to the number of CPUs."
+
+#define OPT_RECOMPRESS_COMPRESS_DESC "Compression type to transcode to. Supported options are `deflate` and `none`."
+#define OPT_RECOMPRESS_NAME_DESC "Name to use when generating package files. Defaults to the input package's name."
+#define OPT_RECOMPRESS_NAMESPACE_DESC "Namespace to use for the generated package. Defaults to the input's namespace."
+#define OPT_RECOMPRESS_JOBS_DESC "Number of resources to extract concurrently. Defaults to the number of CPUs."
+
+#define OPT_RECOMPRESS_FORCE_SHORT ""
+#define OPT_RECOMPRESS_FORCE_LONG "--force"
+#define OPT_RECOMPRESS_FORCE_DESC "Discards staging files left behind by an earlier failed run instead of stopping."
+
+#define OPT_FIND_MEDIA_TYPE_SHORT ""
+#define OPT_FIND_MEDIA_TYPE_LONG "--media-type=<pattern>"
+#define OPT_FIND_MEDIA_TYPE_DESC "Only matches resources whose media type matches the given glob pattern."
+
+#define OPT_FIND_REGEX_SHORT ""
+#define OPT_FIND_REGEX_LONG "--regex"
+#define OPT_FIND_REGEX_DESC "Interprets the path pattern as a POSIX extended regex instead of a glob."
+
+#define OPT_FIND_JOBS_DESC "Number of packages to search concurrently. Defaults to the number of CPUs."
+
 #define OPT_UNPACK_OUTPUT_SHORT "-o <path>"
 #define OPT_UNPACK_OUTPUT_LONG "--output=<path>"
 #define OPT_UNPACK_OUTPUT_DESC "Path to the directory to output extracted files to."
@@ -70,31 +117,83 @@
 #define OPT_UNPACK_RESOURCE_LONG "--resource=<path>"
 #define OPT_UNPACK_RESOURCE_DESC "ARP path to a specific resource to extract from the current archive."
 
+#define OPT_UNPACK_RANGE_SHORT ""
+#define OPT_UNPACK_RANGE_LONG "--range=<offset>:<length>"
+#define OPT_UNPACK_RANGE_DESC "Extracts a byte range of the resource given by -r to <file>.<start>-<end>.range."
+
+#define OPT_UNPACK_PROGRESS_SHORT ""
+#define OPT_UNPACK_PROGRESS_LONG "--progress"
+#define OPT_UNPACK_PROGRESS_DESC "Reports live progress to stderr (as JSON lines if stderr is not a terminal)."
+
+#define OPT_UNPACK_IO_URING_SHORT ""
+#define OPT_UNPACK_IO_URING_LONG "--io-uring"
+#define OPT_UNPACK_IO_URING_DESC "Writes resources in batches through io_uring (Linux only, experimental)."
+
+#define OPT_UNPACK_QUEUE_DEPTH_SHORT ""
+#define OPT_UNPACK_QUEUE_DEPTH_LONG "--queue-depth=<count>"
+#define OPT_UNPACK_QUEUE_DEPTH_DESC "Number of files to write per io_uring batch (Linux only). Defaults to 64."
+
+#define OPT_UNPACK_RESUME_SHORT ""
+#define OPT_UNPACK_RESUME_LONG "--resume"
+#define OPT_UNPACK_RESUME_DESC "Journals completed resources so that an interrupted unpack can pick up where it left off."
+
+#define OPT_UNPACK_RECORD_SHORT ""
+#define OPT_UNPACK_RECORD_LONG "--record-access=<path>"
+#define OPT_UNPACK_RECORD_DESC "Appends the path of the extracted resource to the given access profile."
+
 static const size_t opt_pack_max_short =
     MAX(sizeof(OPT_PACK_COMPRESS_SHORT),
     MAX(sizeof(OPT_PACK_DEFLATE_SHORT),
+    MAX(sizeof(OPT_PACK_INDEX_SHORT),
     MAX(sizeof(OPT_PACK_NAME_SHORT),
     MAX(sizeof(OPT_PACK_MAPPINGS_SHORT),
     MAX(sizeof(OPT_PACK_NAMESPACE_SHORT),
     MAX(sizeof(OPT_PACK_OUTPUT_SHORT),
-        sizeof(OPT_PACK_PART_SHORT)))))));
+    MAX(sizeof(OPT_PACK_PART_SHORT),
+    MAX(sizeof(OPT_PACK_PLAN_SHORT),
+        sizeof(OPT_PACK_PROGRESS_SHORT))))))))));
 
 static const size_t opt_pack_max_long =
     MAX(sizeof(OPT_PACK_COMPRESS_LONG),
     MAX(sizeof(OPT_PACK_DEFLATE_LONG),
+    MAX(sizeof(OPT_PACK_INDEX_LONG),
     MAX(sizeof(OPT_PACK_NAME_LONG),
     MAX(sizeof(OPT_PACK_MAPPINGS_LONG),
     MAX(sizeof(OPT_PACK_NAMESPACE_LONG),
     MAX(sizeof(OPT_PACK_OUTPUT_LONG),
-        sizeof(OPT_PACK_PART_LONG)))))));
+    MAX(sizeof(OPT_PACK_PART_LONG),
+    MAX(sizeof(OPT_PACK_PLAN_LONG),
+        sizeof(OPT_PACK_PROGRESS_LONG))))))))));
 
 static const size_t opt_unpack_max_short =
     MAX(sizeof(OPT_UNPACK_OUTPUT_SHORT),
-        sizeof(OPT_UNPACK_RESOURCE_SHORT));
+    MAX(sizeof(OPT_UNPACK_RESOURCE_SHORT),
+    MAX(sizeof(OPT_UNPACK_RANGE_SHORT),
+    MAX(sizeof(OPT_UNPACK_PROGRESS_SHORT),
+    MAX(sizeof(OPT_UNPACK_RESUME_SHORT),
+    MAX(sizeof(OPT_UNPACK_IO_URING_SHORT),
+    MAX(sizeof(OPT_UNPACK_QUEUE_DEPTH_SHORT),
+        sizeof(OPT_UNPACK_RECORD_SHORT))))))));
 
 static const size_t opt_unpack_max_long =
     MAX(sizeof(OPT_UNPACK_OUTPUT_LONG),
-        sizeof(OPT_UNPACK_RESOURCE_LONG));
+    MAX(sizeof(OPT_UNPACK_RESOURCE_LONG),
+    MAX(sizeof(OPT_UNPACK_RANGE_LONG),
+    MAX(sizeof(OPT_UNPACK_PROGRESS_LONG),
+    MAX(sizeof(OPT_UNPACK_RESUME_LONG),
+    MAX(sizeof(OPT_UNPACK_IO_URING_LONG),
+    MAX(sizeof(OPT_UNPACK_QUEUE_DEPTH_LONG),
+        sizeof(OPT_UNPACK_RECORD_LONG))))))));
+
+static const size_t opt_find_max_short =
+    MAX(sizeof(OPT_BATCH_JOBS_SHORT),
+    MAX(sizeof(OPT_FIND_MEDIA_TYPE_SHORT),
+        sizeof(OPT_FIND_REGEX_SHORT)));
+
+static const size_t opt_find_max_long =
+    MAX(sizeof(OPT_BATCH_JOBS_LONG),
+    MAX(sizeof(OPT_FIND_MEDIA_TYPE_LONG),
+        sizeof(OPT_FIND_REGEX_LONG)));
 
 static void _print_header(void) {
     printf("arptool version " PROJECT_VERSION "\n");
@@ -108,6 +207,10 @@ static void _print_general_help(void) {
     printf(VERB_FORMAT, VERB_PACK, DESC_PACK);
     printf(VERB_FORMAT, VERB_UNPACK, DESC_UNPACK);
     printf(VERB_FORMAT, VERB_LIST, DESC_LIST);
+    printf(VERB_FORMAT, VERB_WATCH, DESC_WATCH);
+    printf(VERB_FORMAT, VERB_RECOMPRESS, DESC_RECOMPRESS);
+    printf(VERB_FORMAT, VERB_BATCH, DESC_BATCH);
+    printf(VERB_FORMAT, VERB_FIND, DESC_FIND);
     printf("For more help with a specific verb, use:\n");
     printf("  arptool --help <verb>\n");
 }
@@ -120,6 +223,8 @@ static void _print_pack_help(void) {
         (int) opt_pack_max_long, OPT_PACK_COMPRESS_LONG, OPT_PACK_COMPRESS_DESC);
     printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_DEFLATE_SHORT,
         (int) opt_pack_max_long, OPT_PACK_DEFLATE_LONG, OPT_PACK_DEFLATE_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_INDEX_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_INDEX_LONG, OPT_PACK_INDEX_DESC);
     printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_NAME_SHORT,
         (int) opt_pack_max_long, OPT_PACK_NAME_LONG, OPT_PACK_NAME_DESC);
     printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_MAPPINGS_SHORT,
@@ -130,6 +235,10 @@ static void _print_pack_help(void) {
         (int) opt_pack_max_long, OPT_PACK_OUTPUT_LONG, OPT_PACK_OUTPUT_DESC);
     printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_PART_SHORT,
         (int) opt_pack_max_long, OPT_PACK_PART_LONG, OPT_PACK_PART_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_PLAN_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_PLAN_LONG, OPT_PACK_PLAN_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_PROGRESS_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_PROGRESS_LONG, OPT_PACK_PROGRESS_DESC);
 }
 
 static void _print_unpack_help(void) {
@@ -140,6 +249,18 @@ static void _print_unpack_help(void) {
         (int) opt_unpack_max_long, OPT_UNPACK_OUTPUT_LONG, OPT_PACK_OUTPUT_DESC);
     printf(PARAM_FORMAT, (int) opt_unpack_max_short, OPT_UNPACK_RESOURCE_SHORT,
         (int) opt_unpack_max_long, OPT_UNPACK_RESOURCE_LONG, OPT_UNPACK_RESOURCE_DESC);
+    printf(PARAM_FORMAT, (int) opt_unpack_max_short, OPT_UNPACK_RANGE_SHORT,
+        (int) opt_unpack_max_long, OPT_UNPACK_RANGE_LONG, OPT_UNPACK_RANGE_DESC);
+    printf(PARAM_FORMAT, (int) opt_unpack_max_short, OPT_UNPACK_PROGRESS_SHORT,
+        (int) opt_unpack_max_long, OPT_UNPACK_PROGRESS_LONG, OPT_UNPACK_PROGRESS_DESC);
+    printf(PARAM_FORMAT, (int) opt_unpack_max_short, OPT_UNPACK_RESUME_SHORT,
+        (int) opt_unpack_max_long, OPT_UNPACK_RESUME_LONG, OPT_UNPACK_RESUME_DESC);
+    printf(PARAM_FORMAT, (int) opt_unpack_max_short, OPT_UNPACK_IO_URING_SHORT,
+        (int) opt_unpack_max_long, OPT_UNPACK_IO_URING_LONG, OPT_UNPACK_IO_URING_DESC);
+    printf(PARAM_FORMAT, (int) opt_unpack_max_short, OPT_UNPACK_QUEUE_DEPTH_SHORT,
+        (int) opt_unpack_max_long, OPT_UNPACK_QUEUE_DEPTH_LONG, OPT_UNPACK_QUEUE_DEPTH_DESC);
+    printf(PARAM_FORMAT, (int) opt_unpack_max_short, OPT_UNPACK_RECORD_SHORT,
+        (int) opt_unpack_max_long, OPT_UNPACK_RECORD_LONG, OPT_UNPACK_RECORD_DESC);
 }
 
 static void _print_list_help(void) {
@@ -147,6 +268,58 @@ static void _print_list_help(void) {
     printf(DESC_LIST "\n");
 }
 
+static void _print_recompress_help(void) {
+    printf("Usage: " RECOMPRESS_USAGE "\n");
+    printf(DESC_RECOMPRESS "\n");
+    printf("Available options:\n");
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_COMPRESS_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_COMPRESS_LONG, OPT_RECOMPRESS_COMPRESS_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_DEFLATE_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_DEFLATE_LONG, OPT_PACK_DEFLATE_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_RECOMPRESS_FORCE_SHORT,
+        (int) opt_pack_max_long, OPT_RECOMPRESS_FORCE_LONG, OPT_RECOMPRESS_FORCE_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_BATCH_JOBS_SHORT,
+        (int) opt_pack_max_long, OPT_BATCH_JOBS_LONG, OPT_RECOMPRESS_JOBS_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_NAME_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_NAME_LONG, OPT_RECOMPRESS_NAME_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_NAMESPACE_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_NAMESPACE_LONG, OPT_RECOMPRESS_NAMESPACE_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_OUTPUT_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_OUTPUT_LONG, OPT_PACK_OUTPUT_DESC);
+    printf(PARAM_FORMAT, (int) opt_pack_max_short, OPT_PACK_PART_SHORT,
+        (int) opt_pack_max_long, OPT_PACK_PART_LONG, OPT_PACK_PART_DESC);
+}
+
+static void _print_batch_help(void) {
+    printf("Usage: " BATCH_USAGE "\n");
+    printf(DESC_BATCH "\n");
+    printf("Each non-empty line of the manifest not starting with `#` is a single job, given as a verb, input path,\n");
+    printf("and options exactly as they would be passed to arptool.\n");
+    printf("Available options:\n");
+    printf(PARAM_FORMAT, (int) sizeof(OPT_BATCH_JOBS_SHORT), OPT_BATCH_JOBS_SHORT,
+        (int) sizeof(OPT_BATCH_JOBS_LONG), OPT_BATCH_JOBS_LONG, OPT_BATCH_JOBS_DESC);
+}
+
+static void _print_find_help(void) {
+    printf("Usage: " FIND_USAGE "\n");
+    printf(DESC_FIND "\n");
+    printf("Patterns are matched against full ARP paths (e.g. `namespace:path/to/resource`). Matches are printed\n");
+    printf("one per line as the package path, media type, and resource path, separated by tabs.\n");
+    printf("Available options:\n");
+    printf(PARAM_FORMAT, (int) opt_find_max_short, OPT_BATCH_JOBS_SHORT,
+        (int) opt_find_max_long, OPT_BATCH_JOBS_LONG, OPT_FIND_JOBS_DESC);
+    printf(PARAM_FORMAT, (int) opt_find_max_short, OPT_FIND_MEDIA_TYPE_SHORT,
+        (int) opt_find_max_long, OPT_FIND_MEDIA_TYPE_LONG, OPT_FIND_MEDIA_TYPE_DESC);
+    printf(PARAM_FORMAT, (int) opt_find_max_short, OPT_FIND_REGEX_SHORT,
+        (int) opt_find_max_long, OPT_FIND_REGEX_LONG, OPT_FIND_REGEX_DESC);
+}
+
+static void _print_watch_help(void) {
+    printf("Usage: " WATCH_USAGE "\n");
+    printf(DESC_WATCH "\n");
+    printf("Accepts the same options as `pack`, except for `--plan`.\n");
+}
+
 int exec_cmd_help(arp_cmd_args_t *args) {
     _print_header();
 
@@ -158,6 +331,14 @@ int exec_cmd_help(arp_cmd_args_t *args) {
         _print_unpack_help();
     } else if (strcmp(args->verb, VERB_LIST) == 0) {
         _print_list_help();
+    } else if (strcmp(args->verb, VERB_WATCH) == 0) {
+        _print_watch_help();
+    } else if (strcmp(args->verb, VERB_RECOMPRESS) == 0) {
+        _print_recompress_help();
+    } else if (strcmp(args->verb, VERB_BATCH) == 0) {
+        _print_batch_help();
+    } else if (strcmp(args->verb, VERB_FIND) == 0) {
+        _print_find_help();
     } else {
         printf("Unrecognized verb %s\n", args->verb);
         printf("For a list of available verbs, please run `arptool --help` without any additional parameters.\n");
@@ -10,13 +10,16 @@
 #include "arg_parse.h"
 #include "cmd_impls.h"
 #include "misc_defines.h"
+#include "path_index.h"
 #include "util.h"
 
 #include "arp/util/error.h"
 #include "arp/unpack/list.h"
 #include "arp/unpack/load.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
@@ -24,48 +27,109 @@
 #define HEADER_TYPE "TYPE"
 #define HEADER_PATH "PATH"
 
-int exec_cmd_list(arp_cmd_args_t *args) {
-    char *src_path = args->src_path;
+typedef struct ListEntry {
+    const char *path;
+    const char *media_type;
+} list_entry_t;
+
+static void _print_listing(const arp_cmd_args_t *args, const list_entry_t *entries, size_t entry_count) {
+    size_t max_path = strlen(HEADER_PATH);
+    size_t max_mt = strlen(HEADER_TYPE);
+    for (size_t i = 0; i < entry_count; i++) {
+        max_path = MAX(max_path, strlen(entries[i].path));
+        max_mt = MAX(max_mt, strlen(entries[i].media_type));
+    }
+
+    arptool_print(args, LogLevelInfo, "%-*s   " HEADER_PATH "\n", (int) max_mt, HEADER_TYPE);
+
+    if (args->verbosity == VerbosityNormal) {
+        for (size_t i = 0; i < max_mt + max_path + 3; i++) {
+            arptool_print(args, LogLevelInfo, "-");
+        }
+
+        arptool_print(args, LogLevelInfo, "\n");
+    }
+
+    for (size_t i = 0; i < entry_count; i++) {
+        arptool_print(args, LogLevelInfo, "%-*s   %s\n", (int) max_mt, entries[i].media_type, entries[i].path);
+    }
+}
+
+static int _list_from_index(const arp_cmd_args_t *args, const arp_path_index_t *index) {
+    size_t entry_count = get_path_index_entry_count(index);
+
+    list_entry_t *entries = NULL;
+    if ((entries = calloc(entry_count > 0 ? entry_count : 1, sizeof(list_entry_t))) == NULL) {
+        arptool_print(args, LogLevelError, "Out of memory\n");
+        return ENOMEM;
+    }
+
+    for (size_t i = 0; i < entry_count; i++) {
+        arp_path_index_entry_t index_entry;
+        if (!get_path_index_entry(index, i, &index_entry)) {
+            free(entries);
+            arptool_print(args, LogLevelError, "Path index is corrupt\n");
+            return EINVAL;
+        }
+
+        entries[i].path = index_entry.path;
+        entries[i].media_type = index_entry.media_type;
+    }
+
+    _print_listing(args, entries, entry_count);
+
+    free(entries);
+
+    return 0;
+}
 
+static int _list_from_package(const arp_cmd_args_t *args) {
     ArpPackage package = NULL;
     int rc = UNINIT_U32;
-    if ((rc = arp_load_from_file(src_path, NULL, &package)) != 0) {
-        arptool_print(args, LogLevelError, "Failed to load package (libarp says: %s)\n", arp_get_error());
+    if ((rc = arp_load_from_file(args->src_path, NULL, &package)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to load package (libarp says: %s)\n", get_libarp_error(args, rc));
         return rc;
     }
 
     arp_resource_listing_t *res_listings = NULL;
     size_t listing_count = 0;
     if ((rc = arp_get_resource_listing(package, &res_listings, &listing_count)) != 0) {
-        arptool_print(args, LogLevelError, "Failed to list resources in package (libarp says: %s)\n", arp_get_error());
+        arptool_print(args, LogLevelError, "Failed to list resources in package (libarp says: %s)\n",
+                get_libarp_error(args, rc));
+        arp_unload(package);
         return rc;
     }
 
-    size_t max_path = strlen(HEADER_PATH);
-    size_t max_ext = 0;
-    size_t max_mt = strlen(HEADER_TYPE);
-    for (size_t i = 0; i < listing_count; i++) {
-        arp_resource_listing_t *listing = &res_listings[i];
-        max_path = MAX(max_path, strlen(listing->path));
-        max_ext = MAX(max_ext, strlen(listing->meta.extension));
-        max_mt = MAX(max_mt, strlen(listing->meta.media_type));
+    list_entry_t *entries = NULL;
+    if ((entries = calloc(listing_count > 0 ? listing_count : 1, sizeof(list_entry_t))) == NULL) {
+        arptool_print(args, LogLevelError, "Out of memory\n");
+        arp_free_resource_listing(res_listings, listing_count);
+        arp_unload(package);
+        return ENOMEM;
     }
 
-    arptool_print(args, LogLevelInfo, "%-*s   " HEADER_PATH "\n", (int) max_mt, HEADER_TYPE);
+    for (size_t i = 0; i < listing_count; i++) {
+        entries[i].path = res_listings[i].path;
+        entries[i].media_type = res_listings[i].meta.media_type;
+    }
 
-    if (args->verbosity == VerbosityNormal) {
-        for (size_t i = 0; i < max_mt + max_path + 3; i++) {
-            putchar('-');
-        }
+    _print_listing(args, entries, listing_count);
 
-        putchar('\n');
-    }
+    free(entries);
+    arp_free_resource_listing(res_listings, listing_count);
+    arp_unload(package);
 
-    for (size_t i = 0; i < listing_count; i++) {
-        arp_resource_listing_t *listing = &res_listings[i];
+    return 0;
+}
 
-        arptool_print(args, LogLevelInfo, "%-*s   %s\n", (int) max_mt, listing->meta.media_type, listing->path);
+int exec_cmd_list(arp_cmd_args_t *args) {
+    // the path index carries everything a listing needs, so prefer it over loading the package and its parts
+    arp_path_index_t index;
+    if (open_path_index(args->src_path, &index) == 0) {
+        int rc = _list_from_index(args, &index);
+        close_path_index(&index);
+        return rc;
     }
 
-    return 0;
+    return _list_from_package(args);
 }
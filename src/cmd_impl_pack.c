@@ -7,15 +7,20 @@
  * license text may be accessed at https://opensource.org/licenses/MIT.
  */
 
+#include "arena.h"
 #include "arg_parse.h"
 #include "arg_util.h"
 #include "cmd_impls.h"
-#include "compression_defines.h"
 #include "file_defines.h"
+#include "fs_util.h"
 #include "misc_defines.h"
+#include "pack_plan.h"
+#include "path_index.h"
+#include "progress.h"
 #include "util.h"
 
 #include "arp/pack/pack.h"
+#include "arp/unpack/load.h"
 #include "arp/util/defines.h"
 #include "arp/util/error.h"
 
@@ -35,6 +40,185 @@
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+#define INITIAL_SOURCE_FILE_CAP 256
+
+// characters which may trail a path in a libarp status message without being part of it
+#define MSG_PATH_TRAILERS " \t\r\n'\".:"
+
+typedef struct PackSourceFile {
+    const char *path;
+    uint64_t size;
+} pack_source_file_t;
+
+typedef struct PackSources {
+    const char *root;
+    pack_source_file_t *files;
+    size_t count;
+    size_t cap;
+    uint64_t total_bytes;
+    arp_arena_t strings;
+} pack_sources_t;
+
+// libarp's message callback carries no user data, so the active progress tracker has to live here
+static arp_progress_t *g_pack_progress = NULL;
+static pack_sources_t *g_pack_sources = NULL;
+
+static int _compare_source_files(const void *a, const void *b) {
+    return strcmp(((const pack_source_file_t *) a)->path, ((const pack_source_file_t *) b)->path);
+}
+
+static int _add_source_file(const char *path, bool is_dir, uint64_t size, void *user_data) {
+    if (is_dir) {
+        return 0;
+    }
+
+    pack_sources_t *sources = user_data;
+    if (sources->count == sources->cap) {
+        size_t new_cap = sources->cap > 0 ? sources->cap * 2 : INITIAL_SOURCE_FILE_CAP;
+        pack_source_file_t *new_files = NULL;
+        if ((new_files = realloc(sources->files, new_cap * sizeof(pack_source_file_t))) == NULL) {
+            return ENOMEM;
+        }
+        sources->files = new_files;
+        sources->cap = new_cap;
+    }
+
+    pack_source_file_t *file = &sources->files[sources->count];
+    if ((file->path = arena_strdup(&sources->strings, path)) == NULL) {
+        return ENOMEM;
+    }
+    file->size = size;
+
+    sources->count += 1;
+    sources->total_bytes += size;
+    return 0;
+}
+
+static void _free_sources(pack_sources_t *sources) {
+    free(sources->files);
+    arena_free(&sources->strings);
+}
+
+static const pack_source_file_t *_find_source_file(const pack_sources_t *sources, const char *path) {
+    pack_source_file_t key = { path, 0 };
+    return bsearch(&key, sources->files, sources->count, sizeof(pack_source_file_t), _compare_source_files);
+}
+
+// works out how many bytes the resource named in a libarp status message accounts for
+static uint64_t _get_msg_bytes(const pack_sources_t *sources, const char *msg) {
+    // used when the message can't be matched to a file, so that the byte-based rate and ETA stay roughly accurate
+    uint64_t avg_bytes = sources->count > 0 ? sources->total_bytes / sources->count : 0;
+
+    const char *path_start = NULL;
+    if ((path_start = strstr(msg, sources->root)) == NULL) {
+        return avg_bytes;
+    }
+
+    unsigned char scratch_buf[ARENA_SCRATCH_LEN];
+    arp_arena_t scratch;
+    arena_init(&scratch, scratch_buf, sizeof(scratch_buf), 0);
+
+    char *path = NULL;
+    if ((path = arena_strdup(&scratch, path_start)) == NULL) {
+        return avg_bytes;
+    }
+
+    uint64_t bytes = avg_bytes;
+    size_t path_len = strlen(path);
+    while (path_len > 0) {
+        const pack_source_file_t *file = NULL;
+        if ((file = _find_source_file(sources, path)) != NULL) {
+            bytes = file->size;
+            break;
+        }
+
+        // the message may end in punctuation, so peel it off one character at a time
+        if (strchr(MSG_PATH_TRAILERS, path[path_len - 1]) == NULL) {
+            break;
+        }
+        path[--path_len] = '\0';
+    }
+
+    arena_free(&scratch);
+
+    return bytes;
+}
+
+static void _pack_msg_callback(const char *msg) {
+    // libarp reports each resource as it is processed
+    if (g_pack_progress == NULL || g_pack_progress->done_files >= g_pack_progress->total_files) {
+        return;
+    }
+
+    uint64_t bytes = _get_msg_bytes(g_pack_sources, msg);
+    if (bytes > g_pack_progress->total_bytes - g_pack_progress->done_bytes) {
+        bytes = g_pack_progress->total_bytes - g_pack_progress->done_bytes;
+    }
+
+    progress_update(g_pack_progress, 1, bytes);
+}
+
+static char *_get_package_path(const char *output_path, const char *package_name) {
+    size_t package_path_len = strlen(output_path) + 1 + strlen(package_name) + sizeof(PACKAGE_EXTENSION);
+    char *package_path = NULL;
+    if ((package_path = malloc(package_path_len)) == NULL) {
+        return NULL;
+    }
+    snprintf(package_path, package_path_len, "%s%c%s" PACKAGE_EXTENSION, output_path, PATH_DELIM, package_name);
+    return package_path;
+}
+
+// an index left over from an earlier pack would otherwise outlive the package it describes
+static int _remove_stale_index(const arp_cmd_args_t *args, const char *output_path, const char *package_name) {
+    char *package_path = NULL;
+    char *index_path = NULL;
+    if ((package_path = _get_package_path(output_path, package_name)) == NULL
+            || (index_path = get_index_path(package_path)) == NULL) {
+        free(package_path);
+        arptool_print(args, LogLevelError, "Out of memory\n");
+        return ENOMEM;
+    }
+
+    int rc = 0;
+    if (remove(index_path) != 0 && errno != ENOENT) {
+        rc = errno;
+        arptool_print(args, LogLevelError, "Failed to remove stale path index %s (rc: %d)\n", index_path, rc);
+    }
+
+    free(index_path);
+    free(package_path);
+
+    return rc;
+}
+
+static int _write_index(const arp_cmd_args_t *args, const char *output_path, const char *package_name) {
+    char *package_path = NULL;
+    if ((package_path = _get_package_path(output_path, package_name)) == NULL) {
+        arptool_print(args, LogLevelError, "Out of memory\n");
+        return ENOMEM;
+    }
+
+    ArpPackage package = NULL;
+    int rc = UNINIT_U32;
+    if ((rc = arp_load_from_file(package_path, NULL, &package)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to load package for indexing (libarp says: %s)\n",
+                get_libarp_error(args, rc));
+        free(package_path);
+        return rc;
+    }
+
+    if ((rc = write_path_index(package, package_path)) == 0) {
+        arptool_print(args, LogLevelInfo, "Successfully wrote path index to %s" INDEX_FILE_SUFFIX "\n", package_path);
+    } else {
+        arptool_print(args, LogLevelError, "Failed to write path index (rc: %d)\n", rc);
+    }
+
+    arp_unload(package);
+    free(package_path);
+
+    return rc;
+}
+
 int exec_cmd_pack(arp_cmd_args_t *args) {
     char *src_path = args->src_path;
     char *output_path = NULL;
@@ -82,19 +266,30 @@ int exec_cmd_pack(arp_cmd_args_t *args) {
         package_namespace[strlen(package_name)] = '\0';
     }
 
-    if (args->compression != NULL) {
-        if (strcmp(args->compression, CMPR_STR_DEFLATE) == 0) {
-            compression_magic = ARP_COMPRESS_TYPE_DEFLATE;
-        } else if (strcmp(args->compression, CMPR_STR_NONE) == 0) {
-            // no-op
-        } else {
-            if (malloced_output_path) {
-                free(output_path);
-            }
+    if (get_compression_magic(args->compression, &compression_magic) != 0) {
+        if (malloced_output_path) {
+            free(output_path);
+        }
 
-            arptool_print(args, LogLevelError, "Unrecognized compression type\n");
-            return EINVAL;
+        arptool_print(args, LogLevelError, "Unrecognized compression type\n");
+        return EINVAL;
+    }
+
+    if (args->plan_only) {
+        if (malloced_output_path) {
+            free(output_path);
         }
+
+        return plan_pack(args, src_path, compression_magic, part_size);
+    }
+
+    int rc = UNINIT_U32;
+    if ((rc = _remove_stale_index(args, output_path, package_name)) != 0) {
+        if (malloced_output_path) {
+            free(output_path);
+        }
+
+        return rc;
     }
 
     ArpPackingOptions opts = arp_create_v1_packing_options(package_name, package_namespace, part_size, compression_magic,
@@ -104,12 +299,42 @@ int exec_cmd_pack(arp_cmd_args_t *args) {
         return errno;
     }
 
-    int rc = UNINIT_U32;
-    if ((rc = arp_pack_from_fs(src_path, output_path, opts, NULL)) == 0) {
+    arp_progress_t progress;
+    pack_sources_t sources;
+    void (*msg_callback)(const char *) = NULL;
+    if (args->show_progress) {
+        memset(&sources, 0, sizeof(sources));
+        sources.root = src_path;
+        arena_init(&sources.strings, NULL, 0, 0);
+
+        // the sizes are only needed for reporting, so a failed scan just means less accurate progress
+        walk_dir(src_path, _add_source_file, &sources);
+        qsort(sources.files, sources.count, sizeof(pack_source_file_t), _compare_source_files);
+
+        progress_init(&progress, args, sources.count, sources.total_bytes);
+        g_pack_progress = &progress;
+        g_pack_sources = &sources;
+        msg_callback = _pack_msg_callback;
+    }
+
+    rc = arp_pack_from_fs(src_path, output_path, opts, msg_callback);
+
+    if (args->show_progress) {
+        progress_finish(&progress);
+        g_pack_progress = NULL;
+        g_pack_sources = NULL;
+        _free_sources(&sources);
+    }
+
+    if (rc == 0) {
         arptool_print(args, LogLevelInfo, "Successfully wrote archive to %s\n", output_path);
+
+        if (args->build_index) {
+            rc = _write_index(args, output_path, package_name);
+        }
     } else {
         arptool_print(args, LogLevelError, "Packing failed\n");
-        arptool_print(args, LogLevelError, "libarp says: %s (rc: %d)\n", arp_get_error(), rc);
+        arptool_print(args, LogLevelError, "libarp says: %s (rc: %d)\n", get_libarp_error(args, rc), rc);
     }
 
     arp_free_packing_options(opts);
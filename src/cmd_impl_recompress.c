@@ -0,0 +1,658 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arena.h"
+#include "arg_parse.h"
+#include "arg_util.h"
+#include "cmd_impls.h"
+#include "file_defines.h"
+#include "fs_util.h"
+#include "misc_defines.h"
+#include "thread_pool.h"
+#include "unpack_util.h"
+#include "util.h"
+
+#include "arp/pack/pack.h"
+#include "arp/unpack/list.h"
+#include "arp/unpack/load.h"
+#include "arp/util/defines.h"
+#include "arp/util/error.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define NAMESPACE_DELIM ':'
+
+#define STAGING_DIR_FORMAT "%s%c.%s.staging"
+#define STAGING_MAPPINGS_FORMAT "%s%c.%s.mappings.csv"
+#define STAGING_OUTPUT_FORMAT "%s%c.%s.output"
+#define STAGING_MANIFEST_FORMAT "%s%c.%s.publish"
+#define MANIFEST_TEMP_SUFFIX ".tmp"
+
+// libarp names every part after the first <name>.partNNN.arp
+#define PART_INFIX ".part"
+
+#define INITIAL_OUTPUT_CAP 4
+
+// what libarp assigns to resources whose extension has no mapping
+#define DEFAULT_MEDIA_TYPE "application/octet-stream"
+
+// file names (without a directory) of the files making up a newly packed package
+typedef struct PackOutputs {
+    char **names;
+    size_t count;
+    size_t cap;
+    arp_arena_t strings;
+} pack_outputs_t;
+
+typedef struct ExtractState {
+    const arp_resource_listing_t *listings;
+    const char *staging_path;
+    int *rcs;
+} extract_state_t;
+
+static char *_format_path(const char *format, const char *dir, const char *name) {
+    size_t len = strlen(format) + strlen(dir) + strlen(name) + 1;
+    char *path = NULL;
+    if ((path = malloc(len)) == NULL) {
+        return NULL;
+    }
+
+    snprintf(path, len, format, dir, PATH_DELIM, name);
+    return path;
+}
+
+static const char *_get_file_name(const char *path) {
+    #ifdef _WIN32
+    const char *delim = MAX(strrchr(path, WIN32_PATH_DELIM), strrchr(path, UNIX_PATH_DELIM));
+    #else
+    const char *delim = strrchr(path, PATH_DELIM);
+    #endif
+
+    return delim != NULL ? delim + 1 : path;
+}
+
+static bool _path_exists(const char *path) {
+    struct stat path_stat;
+    return stat(path, &path_stat) == 0;
+}
+
+static char *_get_default_name(const char *src_path) {
+    const char *base = _get_file_name(src_path);
+    size_t len = strlen(base);
+    size_t ext_len = strlen(PACKAGE_EXTENSION);
+    if (len > ext_len && strcmp(base + len - ext_len, PACKAGE_EXTENSION) == 0) {
+        len -= ext_len;
+    }
+
+    char *name = NULL;
+    if ((name = malloc(len + 1)) == NULL) {
+        return NULL;
+    }
+    memcpy(name, base, len);
+    name[len] = '\0';
+    return name;
+}
+
+static void _extract_resource(size_t task_index, void *user_data) {
+    extract_state_t *state = user_data;
+
+    state->rcs[task_index] = unpack_listing_to_fs(&state->listings[task_index], state->staging_path, NULL);
+}
+
+// libarp derives media types from extensions, so they can be preserved by feeding the originals back in as mappings.
+// A media type that can't be expressed that way would silently change in the new package, so that's treated as an
+// error instead.
+static int _write_mappings(const arp_cmd_args_t *args, const arp_resource_listing_t *listings, size_t count,
+        const char *mappings_path) {
+    FILE *mappings_file = NULL;
+    if ((mappings_file = fopen(mappings_path, "w")) == NULL) {
+        return errno;
+    }
+
+    // packages tend to use only a handful of distinct extensions, so a linear scan over them is plenty
+    const arp_resource_listing_t **seen = NULL;
+    size_t seen_count = 0;
+    size_t seen_cap = 0;
+    int rc = 0;
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        const arp_resource_listing_t *listing = &listings[i];
+        const arp_resource_meta_t *meta = &listing->meta;
+        if (meta->extension == NULL || meta->extension[0] == '\0') {
+            if (strcmp(meta->media_type, DEFAULT_MEDIA_TYPE) != 0) {
+                arptool_print(args, LogLevelError, "Resource %s has media type %s but no extension to map it from\n",
+                        listing->path, meta->media_type);
+                rc = EINVAL;
+            }
+            continue;
+        }
+
+        const arp_resource_listing_t *existing = NULL;
+        for (size_t j = 0; j < seen_count && existing == NULL; j++) {
+            if (strcmp(seen[j]->meta.extension, meta->extension) == 0) {
+                existing = seen[j];
+            }
+        }
+
+        if (existing != NULL) {
+            if (strcmp(existing->meta.media_type, meta->media_type) != 0) {
+                arptool_print(args, LogLevelError, "Extension %s maps to both %s (%s) and %s (%s)\n",
+                        meta->extension, existing->meta.media_type, existing->path, meta->media_type, listing->path);
+                rc = EINVAL;
+            }
+            continue;
+        }
+
+        if (seen_count == seen_cap) {
+            seen_cap = seen_cap > 0 ? seen_cap * 2 : 16;
+            const arp_resource_listing_t **new_seen = NULL;
+            if ((new_seen = realloc(seen, seen_cap * sizeof(arp_resource_listing_t *))) == NULL) {
+                rc = ENOMEM;
+                break;
+            }
+            seen = new_seen;
+        }
+        seen[seen_count++] = listing;
+
+        if (fprintf(mappings_file, "%s,%s\n", meta->extension, meta->media_type) < 0) {
+            rc = EIO;
+        }
+    }
+
+    free(seen);
+
+    if (rc != 0) {
+        fclose(mappings_file);
+        return rc;
+    }
+
+    if (fclose(mappings_file) != 0) {
+        return errno;
+    }
+
+    return 0;
+}
+
+static int _stage_package(const arp_cmd_args_t *args, const char *staging_path, const char *mappings_path,
+        char *out_namespace) {
+    ArpPackage package = NULL;
+    int rc = UNINIT_U32;
+    if ((rc = arp_load_from_file(args->src_path, NULL, &package)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to load package (rc: %d) (libarp says: %s)\n",
+                rc, get_libarp_error(args, rc));
+        return rc;
+    }
+
+    arp_resource_listing_t *listings = NULL;
+    size_t listing_count = 0;
+    if ((rc = arp_get_resource_listing(package, &listings, &listing_count)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to list resources in package (libarp says: %s)\n",
+                get_libarp_error(args, rc));
+        arp_unload(package);
+        return rc;
+    }
+
+    if (listing_count == 0) {
+        arptool_print(args, LogLevelError, "Package contains no resources\n");
+        arp_free_resource_listing(listings, listing_count);
+        arp_unload(package);
+        return EINVAL;
+    }
+
+    const char *ns_delim = strchr(listings[0].path, NAMESPACE_DELIM);
+    size_t ns_len = ns_delim != NULL ? (size_t) (ns_delim - listings[0].path) : 0;
+    if (ns_len == 0 || ns_len > ARP_NAMESPACE_MAX) {
+        arptool_print(args, LogLevelError, "Failed to determine package namespace\n");
+        arp_free_resource_listing(listings, listing_count);
+        arp_unload(package);
+        return EINVAL;
+    }
+    memcpy(out_namespace, listings[0].path, ns_len);
+    out_namespace[ns_len] = '\0';
+
+    if ((rc = _write_mappings(args, listings, listing_count, mappings_path)) == EINVAL) {
+        arptool_print(args, LogLevelError, "Media types can't be carried over to the recompressed package\n");
+    } else if (rc != 0) {
+        arptool_print(args, LogLevelError, "Failed to write media type mappings (rc: %d)\n", rc);
+    }
+
+    int *rcs = NULL;
+    if (rc == 0 && (rcs = calloc(listing_count, sizeof(int))) == NULL) {
+        rc = ENOMEM;
+    }
+
+    if (rc == 0) {
+        extract_state_t state = { .listings = listings, .staging_path = staging_path, .rcs = rcs };
+        size_t worker_count = args->jobs > 0 ? args->jobs : get_cpu_count();
+
+        rc = run_task_pool(listing_count, worker_count, _extract_resource, &state);
+
+        for (size_t i = 0; i < listing_count && rc == 0; i++) {
+            rc = rcs[i];
+        }
+
+        if (rc != 0) {
+            arptool_print(args, LogLevelError, "Failed to extract resources (rc: %d) (libarp says: %s)\n",
+                    rc, get_libarp_error(args, rc));
+        }
+    }
+
+    free(rcs);
+    arp_free_resource_listing(listings, listing_count);
+    arp_unload(package);
+
+    return rc;
+}
+
+static int _add_output(pack_outputs_t *outputs, const char *name) {
+    if (outputs->count == outputs->cap) {
+        size_t new_cap = outputs->cap > 0 ? outputs->cap * 2 : INITIAL_OUTPUT_CAP;
+        char **new_names = NULL;
+        if ((new_names = realloc(outputs->names, new_cap * sizeof(char *))) == NULL) {
+            return ENOMEM;
+        }
+        outputs->names = new_names;
+        outputs->cap = new_cap;
+    }
+
+    if ((outputs->names[outputs->count] = arena_strdup(&outputs->strings, name)) == NULL) {
+        return ENOMEM;
+    }
+    outputs->count += 1;
+
+    return 0;
+}
+
+static int _collect_output(const char *path, bool is_dir, uint64_t size, void *user_data) {
+    (void) size;
+
+    if (is_dir) {
+        return 0;
+    }
+
+    return _add_output(user_data, _get_file_name(path));
+}
+
+// the manifest lists the files making up the new package, so that a publish interrupted partway through can be
+// finished by the next run rather than leaving a mix of old and new parts behind
+static int _write_manifest(const char *manifest_path, const pack_outputs_t *outputs) {
+    size_t temp_path_len = strlen(manifest_path) + sizeof(MANIFEST_TEMP_SUFFIX);
+    char *temp_path = NULL;
+    if ((temp_path = malloc(temp_path_len)) == NULL) {
+        return ENOMEM;
+    }
+    snprintf(temp_path, temp_path_len, "%s" MANIFEST_TEMP_SUFFIX, manifest_path);
+
+    FILE *manifest_file = NULL;
+    if ((manifest_file = fopen(temp_path, "w")) == NULL) {
+        int rc = errno;
+        free(temp_path);
+        return rc;
+    }
+
+    int rc = 0;
+    for (size_t i = 0; i < outputs->count && rc == 0; i++) {
+        if (fprintf(manifest_file, "%s\n", outputs->names[i]) < 0) {
+            rc = EIO;
+        }
+    }
+
+    if (fclose(manifest_file) != 0 && rc == 0) {
+        rc = errno;
+    }
+
+    // the manifest only appears under its real name once it's complete and on disk
+    if (rc == 0) {
+        rc = sync_file(temp_path);
+    }
+
+    #ifdef _WIN32
+    // rename won't replace an existing file on Windows
+    if (rc == 0) {
+        remove(manifest_path);
+    }
+    #endif
+
+    if (rc == 0 && rename(temp_path, manifest_path) != 0) {
+        rc = errno;
+    }
+
+    if (rc != 0) {
+        remove(temp_path);
+    }
+    free(temp_path);
+
+    return rc;
+}
+
+static int _read_manifest(const char *manifest_path, pack_outputs_t *outputs) {
+    FILE *manifest_file = NULL;
+    if ((manifest_file = fopen(manifest_path, "rb")) == NULL) {
+        return errno;
+    }
+
+    char *contents = NULL;
+    long len = 0;
+    int rc = 0;
+    if (fseek(manifest_file, 0, SEEK_END) != 0 || (len = ftell(manifest_file)) < 0
+            || fseek(manifest_file, 0, SEEK_SET) != 0) {
+        rc = EIO;
+    } else if ((contents = malloc((size_t) len + 1)) == NULL) {
+        rc = ENOMEM;
+    } else if (fread(contents, 1, (size_t) len, manifest_file) != (size_t) len) {
+        rc = EIO;
+    }
+
+    fclose(manifest_file);
+
+    if (rc == 0) {
+        contents[len] = '\0';
+
+        char *line = contents;
+        while (rc == 0 && *line != '\0') {
+            char *line_end = strchr(line, '\n');
+            if (line_end != NULL) {
+                *line_end = '\0';
+            }
+
+            if (*line != '\0') {
+                rc = _add_output(outputs, line);
+            }
+
+            if (line_end == NULL) {
+                break;
+            }
+            line = line_end + 1;
+        }
+    }
+
+    free(contents);
+
+    return rc;
+}
+
+typedef struct StalePartState {
+    const arp_cmd_args_t *args;
+    const char *package_name;
+    const pack_outputs_t *outputs;
+} stale_part_state_t;
+
+static bool _is_part_file(const char *file_name, const char *package_name) {
+    size_t name_len = strlen(package_name);
+    size_t infix_len = strlen(PART_INFIX);
+    if (strncmp(file_name, package_name, name_len) != 0 || strncmp(file_name + name_len, PART_INFIX, infix_len) != 0) {
+        return false;
+    }
+
+    const char *part_index = file_name + name_len + infix_len;
+    size_t digit_count = strspn(part_index, "0123456789");
+    return digit_count > 0 && strcmp(part_index + digit_count, PACKAGE_EXTENSION) == 0;
+}
+
+static int _remove_stale_part(const char *path, bool is_dir, uint64_t size, void *user_data) {
+    (void) size;
+
+    stale_part_state_t *state = user_data;
+    const char *file_name = _get_file_name(path);
+    if (is_dir || !_is_part_file(file_name, state->package_name)) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < state->outputs->count; i++) {
+        if (strcmp(state->outputs->names[i], file_name) == 0) {
+            return 0;
+        }
+    }
+
+    if (remove(path) != 0) {
+        int rc = errno;
+        arptool_print(state->args, LogLevelError, "Failed to remove stale part %s (%s)\n", path, strerror(rc));
+        return rc;
+    }
+
+    return 0;
+}
+
+// moves whatever files listed in the manifest are still in the packing output directory into place, then removes any
+// parts of the old package that the new one doesn't replace (e.g. because it has fewer parts)
+static int _finish_publish(const arp_cmd_args_t *args, const char *package_name, const char *pack_out_path,
+        const char *output_path, const char *manifest_path, const pack_outputs_t *outputs) {
+    int rc = 0;
+    for (size_t i = 0; i < outputs->count && rc == 0; i++) {
+        char *src = NULL;
+        char *dest = NULL;
+        if ((src = _format_path("%s%c%s", pack_out_path, outputs->names[i])) == NULL
+                || (dest = _format_path("%s%c%s", output_path, outputs->names[i])) == NULL) {
+            free(src);
+            rc = ENOMEM;
+            break;
+        }
+
+        // anything missing was already moved before an earlier publish was interrupted
+        if (_path_exists(src)) {
+            #ifdef _WIN32
+            // rename won't replace an existing file on Windows
+            remove(dest);
+            #endif
+
+            if (rename(src, dest) != 0) {
+                rc = errno;
+                arptool_print(args, LogLevelError, "Failed to move %s to %s (%s)\n", src, dest, strerror(rc));
+            }
+        }
+
+        free(src);
+        free(dest);
+    }
+
+    if (rc == 0) {
+        stale_part_state_t state = { .args = args, .package_name = package_name, .outputs = outputs };
+        if ((rc = list_dir(output_path, _remove_stale_part, &state)) != 0) {
+            arptool_print(args, LogLevelError, "Failed to remove stale parts from %s (rc: %d)\n", output_path, rc);
+        }
+    }
+
+    if (rc == 0 && remove(manifest_path) != 0) {
+        rc = errno;
+        arptool_print(args, LogLevelError, "Failed to remove publish manifest %s (%s)\n", manifest_path, strerror(rc));
+    }
+
+    return rc;
+}
+
+// moves the freshly packed files into the output directory, replacing any existing files (possibly including the
+// source package) only once the new package has been written in full
+static int _publish_outputs(const arp_cmd_args_t *args, const char *package_name, const char *pack_out_path,
+        const char *output_path, const char *manifest_path, bool *out_started) {
+    pack_outputs_t outputs;
+    memset(&outputs, 0, sizeof(outputs));
+    arena_init(&outputs.strings, NULL, 0, 0);
+
+    int rc = 0;
+    if ((rc = list_dir(pack_out_path, _collect_output, &outputs)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to enumerate packed files in %s (rc: %d)\n", pack_out_path, rc);
+    } else if ((rc = _write_manifest(manifest_path, &outputs)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to write publish manifest %s (rc: %d)\n", manifest_path, rc);
+    } else {
+        *out_started = true;
+        rc = _finish_publish(args, package_name, pack_out_path, output_path, manifest_path, &outputs);
+    }
+
+    free(outputs.names);
+    arena_free(&outputs.strings);
+
+    return rc;
+}
+
+static int _remove_leftover(const arp_cmd_args_t *args, const char *path, bool is_dir) {
+    int rc = is_dir ? remove_tree(path) : (remove(path) == 0 ? 0 : errno);
+    if (rc != 0 && rc != ENOENT) {
+        arptool_print(args, LogLevelError, "Failed to remove %s left behind by an earlier run (rc: %d)\n", path, rc);
+        return rc;
+    }
+
+    return 0;
+}
+
+// a publish that was interrupted partway through is finished before anything else happens, since the old package may
+// already be partly replaced by then. Otherwise, staged resources left behind by a failed run may be the only complete
+// copy of a package's contents, so they're only discarded when explicitly asked to.
+static int _recover_previous_run(const arp_cmd_args_t *args, const char *package_name, const char *output_path,
+        const char *staging_path, const char *mappings_path, const char *pack_out_path, const char *manifest_path) {
+    int rc = 0;
+    if (_path_exists(manifest_path)) {
+        arptool_print(args, LogLevelInfo, "Finishing interrupted publish of %s from an earlier run\n", package_name);
+
+        pack_outputs_t outputs;
+        memset(&outputs, 0, sizeof(outputs));
+        arena_init(&outputs.strings, NULL, 0, 0);
+
+        if ((rc = _read_manifest(manifest_path, &outputs)) != 0) {
+            arptool_print(args, LogLevelError, "Failed to read publish manifest %s (rc: %d)\n", manifest_path, rc);
+        } else {
+            rc = _finish_publish(args, package_name, pack_out_path, output_path, manifest_path, &outputs);
+        }
+
+        free(outputs.names);
+        arena_free(&outputs.strings);
+
+        if (rc != 0) {
+            return rc;
+        }
+    } else if (_path_exists(staging_path) && !args->force) {
+        arptool_print(args, LogLevelError, "Found resources staged by an earlier run in %s\n", staging_path);
+        arptool_print(args, LogLevelError, "Recover them or pass --force to discard them\n");
+        return EEXIST;
+    }
+
+    if ((rc = _remove_leftover(args, staging_path, true)) != 0
+            || (rc = _remove_leftover(args, pack_out_path, true)) != 0
+            || (rc = _remove_leftover(args, mappings_path, false)) != 0) {
+        return rc;
+    }
+
+    return 0;
+}
+
+int exec_cmd_recompress(arp_cmd_args_t *args) {
+    char *compression_magic = NULL;
+    if (args->compression == NULL) {
+        arptool_print(args, LogLevelError, "A target compression type must be specified\n");
+        return EINVAL;
+    } else if (get_compression_magic(args->compression, &compression_magic) != 0) {
+        arptool_print(args, LogLevelError, "Unrecognized compression type\n");
+        return EINVAL;
+    }
+
+    char *output_path = NULL;
+    bool malloced_output_path = false;
+    if ((output_path = get_output_path(args, &malloced_output_path)) == NULL) {
+        return errno;
+    }
+
+    const char *name = args->package_name;
+    char *package_name = NULL;
+    char *staging_path = NULL;
+    char *mappings_path = NULL;
+    char *pack_out_path = NULL;
+    char *manifest_path = NULL;
+    int rc = 0;
+    if (name == NULL && (name = package_name = _get_default_name(args->src_path)) == NULL) {
+        rc = ENOMEM;
+    } else if ((staging_path = _format_path(STAGING_DIR_FORMAT, output_path, name)) == NULL
+            || (mappings_path = _format_path(STAGING_MAPPINGS_FORMAT, output_path, name)) == NULL
+            || (pack_out_path = _format_path(STAGING_OUTPUT_FORMAT, output_path, name)) == NULL
+            || (manifest_path = _format_path(STAGING_MANIFEST_FORMAT, output_path, name)) == NULL) {
+        rc = ENOMEM;
+    }
+
+    // once extraction succeeds, the staged resources may be the only complete copy of the package's contents (e.g. if
+    // the output replaces the source), so they're only cleaned up after the new package is in place
+    bool keep_staging = false;
+    // likewise, once any of the new package has been moved into place the rest of it is needed to finish the job
+    bool keep_pack_out = false;
+
+    if (rc == 0 && (rc = _recover_previous_run(args, name, output_path, staging_path, mappings_path, pack_out_path,
+            manifest_path)) != 0) {
+        // nothing from the earlier run may be cleaned up until it's been dealt with
+        keep_staging = true;
+        keep_pack_out = true;
+    }
+
+    if (rc == 0) {
+        if ((rc = mkdirs(staging_path)) != 0) {
+            arptool_print(args, LogLevelError, "Failed to create staging directory %s\n", staging_path);
+        } else if ((rc = mkdirs(pack_out_path)) != 0) {
+            arptool_print(args, LogLevelError, "Failed to create output staging directory %s\n", pack_out_path);
+        }
+    }
+
+    char orig_namespace[ARP_NAMESPACE_MAX + 1];
+    if (rc == 0 && (rc = _stage_package(args, staging_path, mappings_path, orig_namespace)) == 0) {
+        const char *namespace = args->package_namespace != NULL ? args->package_namespace : orig_namespace;
+
+        // resources are staged beneath a directory named for their namespace
+        char *pack_src_path = _format_path("%s%c%s", staging_path, orig_namespace);
+        ArpPackingOptions opts = NULL;
+        if (pack_src_path == NULL) {
+            rc = ENOMEM;
+        } else if ((opts = arp_create_v1_packing_options(name, namespace, args->part_size, compression_magic,
+                mappings_path)) == NULL) {
+            rc = errno;
+        } else if ((rc = arp_pack_from_fs(pack_src_path, pack_out_path, opts, NULL)) != 0) {
+            arptool_print(args, LogLevelError, "Packing failed\n");
+            arptool_print(args, LogLevelError, "libarp says: %s (rc: %d)\n", get_libarp_error(args, rc), rc);
+        } else if ((rc = _publish_outputs(args, name, pack_out_path, output_path, manifest_path,
+                &keep_pack_out)) == 0) {
+            arptool_print(args, LogLevelInfo, "Successfully wrote recompressed archive to %s\n", output_path);
+        }
+
+        if (rc != 0) {
+            keep_staging = true;
+            arptool_print(args, LogLevelError, "Extracted resources were kept in %s\n", staging_path);
+            if (keep_pack_out) {
+                arptool_print(args, LogLevelError, "The new package was only partly moved into place; run the same "
+                        "command again to finish\n");
+            }
+        }
+
+        if (opts != NULL) {
+            arp_free_packing_options(opts);
+        }
+        free(pack_src_path);
+    }
+
+    if (staging_path != NULL && !keep_staging) {
+        remove_tree(staging_path);
+    }
+    if (mappings_path != NULL && !keep_staging) {
+        remove(mappings_path);
+    }
+    if (pack_out_path != NULL && (rc == 0 || !keep_pack_out)) {
+        remove_tree(pack_out_path);
+    }
+
+    free(staging_path);
+    free(mappings_path);
+    free(pack_out_path);
+    free(manifest_path);
+    free(package_name);
+
+    if (malloced_output_path) {
+        free(output_path);
+    }
+
+    return rc;
+}
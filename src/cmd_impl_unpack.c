@@ -8,12 +8,20 @@
  */
 
 #include "arg_parse.h"
+#include "arena.h"
 #include "arg_util.h"
+#include "batch_writer.h"
 #include "cmd_impls.h"
 #include "file_defines.h"
+#include "fs_util.h"
 #include "misc_defines.h"
+#include "path_index.h"
+#include "progress.h"
+#include "unpack_journal.h"
+#include "unpack_util.h"
 #include "util.h"
 
+#include "arp/unpack/list.h"
 #include "arp/unpack/load.h"
 #include "arp/unpack/resource.h"
 #include "arp/unpack/unpack.h"
@@ -24,16 +32,222 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static int _record_access(const char *log_path, const char *res_path) {
+    FILE *log_file = NULL;
+    if ((log_file = fopen(log_path, "a")) == NULL) {
+        return errno;
+    }
+
+    int rc = 0;
+    if (fprintf(log_file, "%s\n", res_path) < 0) {
+        rc = EIO;
+    }
+
+    if (fclose(log_file) != 0 && rc == 0) {
+        rc = errno;
+    }
+
+    return rc;
+}
+
+static bool _is_output_intact(const char *out_file_path, uint64_t expected_size) {
+    struct stat out_stat;
+    return stat(out_file_path, &out_stat) == 0 && (uint64_t) out_stat.st_size == expected_size;
+}
+
+// extracts a single resource, skipping it if the journal says it was already written and it's still on disk
+static int _unpack_listing_journaled(arp_arena_t *scratch, const arp_resource_listing_t *listing,
+        const char *output_path, arp_output_dir_cache_t *dir_cache, arp_unpack_journal_t *journal, bool *out_skipped) {
+    *out_skipped = false;
+
+    char *out_dir = NULL;
+    char *out_file_path = NULL;
+    if ((out_dir = get_resource_output_dir(scratch, output_path, listing->path)) == NULL
+            || (out_file_path = get_resource_output_file(scratch, out_dir, &listing->meta)) == NULL) {
+        return ENOMEM;
+    }
+
+    int rc = 0;
+    if (is_resource_journaled(journal, listing->path) && _is_output_intact(out_file_path, listing->meta.size)) {
+        *out_skipped = true;
+    } else if ((rc = ensure_output_dir(dir_cache, output_path, out_dir)) == 0
+            && (rc = arp_unpack_resource_to_fs(&listing->meta, out_dir)) == 0) {
+        // the entry may only be journaled once the content is durable, otherwise a crash could leave a torn file
+        // that a later run would trust
+        if ((rc = sync_file(out_file_path)) == 0) {
+            rc = journal_resource(journal, listing->path);
+        }
+    }
+
+    return rc;
+}
+
+static void _report_writer_progress(arp_progress_t *progress, const arp_batch_writer_t *writer,
+        uint64_t *reported_files, uint64_t *reported_bytes) {
+    uint64_t done_files = 0;
+    uint64_t done_bytes = 0;
+    batch_writer_get_progress(writer, &done_files, &done_bytes);
+
+    // the writer completes resources in batches, so progress advances whenever one lands
+    if (done_files != *reported_files) {
+        progress_update(progress, done_files - *reported_files, done_bytes - *reported_bytes);
+        *reported_files = done_files;
+        *reported_bytes = done_bytes;
+    }
+}
+
+static int _unpack_listings(const arp_cmd_args_t *args, ConstArpPackage package, const char *output_path,
+        arp_batch_writer_t *writer) {
+    arp_resource_listing_t *listings = NULL;
+    size_t listing_count = 0;
+    int rc = UNINIT_U32;
+    if ((rc = arp_get_resource_listing(package, &listings, &listing_count)) != 0) {
+        return rc;
+    }
+
+    // everything below is created relative to the output root, so it has to exist first
+    if ((rc = mkdirs(output_path)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to create output directory %s (rc: %d)\n", output_path, rc);
+        arp_free_resource_listing(listings, listing_count);
+        return rc;
+    }
+
+    arp_unpack_journal_t journal;
+    if (args->resume) {
+        if ((rc = open_unpack_journal(output_path, args->src_path, &journal)) != 0) {
+            arptool_print(args, LogLevelError, "Failed to open resume journal (rc: %d)\n", rc);
+            arp_free_resource_listing(listings, listing_count);
+            return rc;
+        }
+
+        if (journal.completed_count > 0) {
+            arptool_print(args, LogLevelInfo, "Resuming unpack with %zu resource(s) already journaled\n",
+                    journal.completed_count);
+        }
+    }
+
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < listing_count; i++) {
+        total_bytes += listings[i].meta.size;
+    }
+
+    arp_progress_t progress;
+    progress_init(&progress, args, listing_count, total_bytes);
+
+    // path strings only live for a single iteration, so they're carved out of a scratch buffer that gets rewound
+    unsigned char scratch_buf[ARENA_SCRATCH_LEN];
+    arp_arena_t scratch;
+    arena_init(&scratch, scratch_buf, sizeof(scratch_buf), 0);
+
+    arp_output_dir_cache_t dir_cache;
+    output_dir_cache_init(&dir_cache);
+
+    size_t skipped_count = 0;
+    uint64_t writer_files = 0;
+    uint64_t writer_bytes = 0;
+    for (size_t i = 0; i < listing_count; i++) {
+        if (args->resume) {
+            bool skipped = false;
+            rc = _unpack_listing_journaled(&scratch, &listings[i], output_path, &dir_cache, &journal, &skipped);
+            arena_reset(&scratch);
+            if (rc != 0) {
+                break;
+            }
+
+            if (skipped) {
+                skipped_count += 1;
+            }
+        } else if (writer != NULL) {
+            if ((rc = batch_writer_add(writer, &listings[i], output_path)) != 0) {
+                break;
+            }
+
+            _report_writer_progress(&progress, writer, &writer_files, &writer_bytes);
+            continue;
+        } else if ((rc = unpack_listing_to_fs(&listings[i], output_path, &dir_cache)) != 0) {
+            break;
+        }
+
+        progress_update(&progress, 1, listings[i].meta.size);
+    }
+
+    if (writer != NULL && rc == 0 && (rc = batch_writer_flush(writer)) == 0) {
+        _report_writer_progress(&progress, writer, &writer_files, &writer_bytes);
+    }
+
+    arena_free(&scratch);
+    output_dir_cache_free(&dir_cache);
+
+    progress_finish(&progress);
+
+    if (args->resume) {
+        // the journal is only useful for finishing an interrupted unpack, so it goes away once there's nothing left
+        int close_rc = close_unpack_journal(&journal, rc == 0);
+        if (rc == 0) {
+            rc = close_rc;
+        }
+
+        if (skipped_count > 0) {
+            arptool_print(args, LogLevelInfo, "Skipped %zu previously extracted resource(s)\n", skipped_count);
+        }
+    }
+
+    arp_free_resource_listing(listings, listing_count);
+
+    return rc;
+}
 
 int exec_cmd_unpack(arp_cmd_args_t *args) {
     char *src_path = args->src_path;
     char *output_path = NULL;
 
+    if (args->access_log_path != NULL && args->resource_path == NULL) {
+        arptool_print(args, LogLevelError, "Access log param requires a resource path\n");
+        return EINVAL;
+    }
+
+    if (args->has_range && args->resource_path == NULL) {
+        arptool_print(args, LogLevelError, "Range param requires a resource path\n");
+        return EINVAL;
+    }
+
+    if (args->resume && args->resource_path != NULL) {
+        arptool_print(args, LogLevelError, "Resume flag does not make sense with a resource path\n");
+        return EINVAL;
+    }
+
+    if (args->use_io_uring && (args->resource_path != NULL || args->resume)) {
+        arptool_print(args, LogLevelError, "io_uring flag only applies when unpacking a whole package without "
+                "resuming\n");
+        return EINVAL;
+    }
+
     bool malloced_output_path = false;
     if ((output_path = get_output_path(args, &malloced_output_path)) == NULL) {
         return errno;
     }
 
+    if (args->resource_path != NULL) {
+        // a present index lets us reject missing resources without paying for a full package load
+        arp_path_index_t index;
+        if (open_path_index(src_path, &index) == 0) {
+            bool found = find_in_path_index(&index, args->resource_path, NULL);
+            close_path_index(&index);
+
+            if (!found) {
+                if (malloced_output_path) {
+                    free(output_path);
+                }
+
+                arptool_print(args, LogLevelError, "Resource %s does not exist in package\n", args->resource_path);
+                return ENOENT;
+            }
+        }
+    }
+
     ArpPackage package = NULL;
     int rc = UNINIT_U32;
     if ((rc = arp_load_from_file(src_path, NULL, &package)) != 0) {
@@ -41,7 +255,8 @@ int exec_cmd_unpack(arp_cmd_args_t *args) {
             free(output_path);
         }
 
-        arptool_print(args, LogLevelError, "Failed to load package (rc: %d) (libarp says: %s)\n", rc, arp_get_error());
+        arptool_print(args, LogLevelError, "Failed to load package (rc: %d) (libarp says: %s)\n",
+                rc, get_libarp_error(args, rc));
         return rc;
     }
 
@@ -56,27 +271,71 @@ int exec_cmd_unpack(arp_cmd_args_t *args) {
                 free(output_path);
             }
 
-            arptool_print(args, LogLevelError, "Failed to get resource meta (libarp says: %s)\n", arp_get_error());
+            arptool_print(args, LogLevelError, "Failed to get resource meta (libarp says: %s)\n",
+                    get_libarp_error(args, rc));
             return rc;
         }
 
-        rc = arp_unpack_resource_to_fs(&meta, output_path);
+        char *range_file_path = NULL;
+        if (args->has_range) {
+            rc = unpack_resource_range_to_fs(&meta, output_path, args->range_offset, args->range_length,
+                    &range_file_path);
+        } else {
+            rc = arp_unpack_resource_to_fs(&meta, output_path);
+        }
 
         if (rc == 0) {
-            arptool_print(args, LogLevelInfo, "Successfully unpacked %s to disk\n", args->resource_path);
+            if (range_file_path != NULL) {
+                arptool_print(args, LogLevelInfo, "Successfully unpacked range of %s to %s\n", args->resource_path,
+                        range_file_path);
+                free(range_file_path);
+            } else {
+                arptool_print(args, LogLevelInfo, "Successfully unpacked %s to disk\n", args->resource_path);
+            }
+
+            if (args->access_log_path != NULL && _record_access(args->access_log_path, args->resource_path) != 0) {
+                arptool_print(args, LogLevelError, "Failed to append to access log %s\n", args->access_log_path);
+            }
+        } else if (args->has_range) {
+            // range extraction is done by arptool itself, so libarp's error text doesn't describe the failure
+            if (rc == ERANGE) {
+                arptool_print(args, LogLevelError, "Range offset %llu is past the end of the %llu-byte resource\n",
+                        (unsigned long long) args->range_offset, (unsigned long long) meta.size);
+            } else {
+                arptool_print(args, LogLevelError, "Failed to unpack resource range to disk (%s)\n", strerror(rc));
+            }
         } else {
             arptool_print(args, LogLevelError, "Failed to unpack resource to disk (libarp says: %s)\n",
-                    arp_get_error());
+                    get_libarp_error(args, rc));
         }
 
-
-        rc = 0;
+        // a failed range extraction is reported through the exit code so that scripts fetching byte ranges notice it
+        if (!args->has_range) {
+            rc = 0;
+        }
     } else {
-        if ((rc = arp_unpack_to_fs(package, output_path)) == 0) {
+        // the batched writer lays out files itself rather than through libarp, so it's only used when asked for
+        arp_batch_writer_t *writer = NULL;
+        if (args->use_io_uring
+                && batch_writer_create(args->queue_depth > 0 ? args->queue_depth : DEFAULT_QUEUE_DEPTH, &writer) != 0) {
+            arptool_print(args, LogLevelInfo, "io_uring is unavailable, writing files one at a time\n");
+        }
+
+        if (args->show_progress || args->resume || writer != NULL) {
+            rc = _unpack_listings(args, package, output_path, writer);
+        } else {
+            rc = arp_unpack_to_fs(package, output_path);
+        }
+
+        if (writer != NULL) {
+            batch_writer_free(writer);
+        }
+
+        if (rc == 0) {
             arptool_print(args, LogLevelInfo, "Successfully unpacked package to disk!\n");
         } else {
             arptool_print(args, LogLevelError, "Failed to unpack package to disk (rc: %d) (libarp says: %s)\n",
-                    rc, arp_get_error());
+                    rc, get_libarp_error(args, rc));
         }
     }
 
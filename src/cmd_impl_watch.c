@@ -0,0 +1,313 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arg_parse.h"
+#include "cmd_impls.h"
+#include "misc_defines.h"
+#include "util.h"
+
+#include <errno.h>
+
+#ifdef __linux__
+#include "arena.h"
+#include "file_defines.h"
+#include "fs_util.h"
+#include "path_index.h"
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// changes arriving within this window of each other are coalesced into a single repack
+#define DEBOUNCE_MS 300
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF \
+        | IN_ONLYDIR)
+
+#define EVENT_BUF_LEN 16384
+
+typedef struct WatchState {
+    arp_cmd_args_t *args;
+    int notify_fd;
+    int root_wd;
+    bool root_removed;
+    // events only carry a descriptor and a name, so each descriptor maps back to the directory it watches
+    char **dir_paths;
+    size_t dir_path_cap;
+} watch_state_t;
+
+static int _set_watch_path(watch_state_t *state, int wd, const char *path) {
+    size_t index = (size_t) wd;
+    if (index >= state->dir_path_cap) {
+        size_t new_cap = state->dir_path_cap > 0 ? state->dir_path_cap : 64;
+        while (new_cap <= index) {
+            new_cap *= 2;
+        }
+
+        char **new_paths = NULL;
+        if ((new_paths = realloc(state->dir_paths, new_cap * sizeof(char *))) == NULL) {
+            return ENOMEM;
+        }
+        memset(new_paths + state->dir_path_cap, 0, (new_cap - state->dir_path_cap) * sizeof(char *));
+        state->dir_paths = new_paths;
+        state->dir_path_cap = new_cap;
+    }
+
+    size_t path_len = strlen(path);
+    char *path_copy = NULL;
+    if ((path_copy = malloc(path_len + 1)) == NULL) {
+        return ENOMEM;
+    }
+    memcpy(path_copy, path, path_len + 1);
+
+    // adding a watch to a directory that already has one hands back the same descriptor
+    free(state->dir_paths[index]);
+    state->dir_paths[index] = path_copy;
+
+    return 0;
+}
+
+static const char *_get_watch_path(const watch_state_t *state, int wd) {
+    return wd >= 0 && (size_t) wd < state->dir_path_cap ? state->dir_paths[wd] : NULL;
+}
+
+static void _forget_watch(watch_state_t *state, int wd) {
+    if (wd >= 0 && (size_t) wd < state->dir_path_cap) {
+        free(state->dir_paths[wd]);
+        state->dir_paths[wd] = NULL;
+    }
+}
+
+static int _add_watch(const char *path, bool is_dir, uint64_t size, void *user_data) {
+    (void) size;
+
+    if (!is_dir) {
+        return 0;
+    }
+
+    watch_state_t *state = user_data;
+    int wd = inotify_add_watch(state->notify_fd, path, WATCH_MASK);
+    if (wd < 0) {
+        // the directory may already be gone again, in which case its parent reports that too
+        return errno == ENOENT || errno == ENOTDIR ? 0 : errno;
+    }
+
+    return _set_watch_path(state, wd, path);
+}
+
+static int _watch_tree(watch_state_t *state, const char *root) {
+    int rc = 0;
+    if ((rc = _add_watch(root, true, 0, state)) == 0) {
+        rc = walk_dir(root, _add_watch, state);
+    }
+    return rc;
+}
+
+// stops watching a directory that was moved away, along with everything below it. the IN_IGNORED events that follow
+// take care of forgetting the paths.
+static void _unwatch_tree(watch_state_t *state, const char *root) {
+    size_t root_len = strlen(root);
+    for (size_t wd = 0; wd < state->dir_path_cap; wd++) {
+        const char *path = state->dir_paths[wd];
+        if (path != NULL && strncmp(path, root, root_len) == 0
+                && (path[root_len] == '\0' || path[root_len] == PATH_DELIM)) {
+            inotify_rm_watch(state->notify_fd, (int) wd);
+        }
+    }
+}
+
+static bool _ends_with(const char *str, const char *suffix) {
+    size_t str_len = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    return str_len >= suffix_len && strcmp(str + str_len - suffix_len, suffix) == 0;
+}
+
+static bool _is_relevant_event(const struct inotify_event *event) {
+    if (event->mask & IN_IGNORED) {
+        return false;
+    }
+
+    // our own output may be written into the watched tree, so don't let it trigger another repack
+    if (event->len > 0 && (_ends_with(event->name, PACKAGE_EXTENSION)
+            || _ends_with(event->name, PACKAGE_EXTENSION INDEX_FILE_SUFFIX))) {
+        return false;
+    }
+
+    return true;
+}
+
+// keeps the watch set in step with directories being created, moved, and removed
+static void _update_watches(watch_state_t *state, const struct inotify_event *event) {
+    if (event->mask & IN_Q_OVERFLOW) {
+        // some events were dropped, so there's no telling which directories appeared and the whole tree is rewalked
+        int rc = 0;
+        if ((rc = _watch_tree(state, state->args->src_path)) != 0) {
+            arptool_print(state->args, LogLevelError, "Failed to rescan source directory (errno: %d)\n", rc);
+        }
+        return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+        _forget_watch(state, event->wd);
+        if (event->wd == state->root_wd) {
+            state->root_removed = true;
+        }
+        return;
+    }
+
+    const char *parent_path = NULL;
+    if (!(event->mask & IN_ISDIR) || event->len == 0 || (parent_path = _get_watch_path(state, event->wd)) == NULL) {
+        return;
+    }
+
+    unsigned char scratch_buf[ARENA_SCRATCH_LEN];
+    arp_arena_t scratch;
+    arena_init(&scratch, scratch_buf, sizeof(scratch_buf), 0);
+
+    size_t path_len = strlen(parent_path) + 1 + strlen(event->name) + 1;
+    char *path = NULL;
+    if ((path = arena_alloc(&scratch, path_len)) == NULL) {
+        arptool_print(state->args, LogLevelError, "Out of memory while watching %s\n", event->name);
+        return;
+    }
+    snprintf(path, path_len, "%s%c%s", parent_path, PATH_DELIM, event->name);
+
+    int rc = 0;
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        if ((rc = _watch_tree(state, path)) != 0) {
+            arptool_print(state->args, LogLevelError, "Failed to watch %s (errno: %d)\n", path, rc);
+        }
+    } else if (event->mask & IN_MOVED_FROM) {
+        _unwatch_tree(state, path);
+    }
+
+    arena_free(&scratch);
+}
+
+// drains all pending events, flagging whether any of them warrant a repack
+static int _drain_events(watch_state_t *state, bool *out_relevant) {
+    // aligned so that the inotify_event structs read out of it are properly aligned as well
+    _Alignas(struct inotify_event) char buf[EVENT_BUF_LEN];
+
+    ssize_t len = read(state->notify_fd, buf, sizeof(buf));
+    if (len < 0) {
+        return errno == EAGAIN ? 0 : errno;
+    }
+
+    for (char *ptr = buf; ptr < buf + len;) {
+        const struct inotify_event *event = (const struct inotify_event *) ptr;
+
+        _update_watches(state, event);
+
+        if (_is_relevant_event(event)) {
+            *out_relevant = true;
+        }
+
+        ptr += sizeof(struct inotify_event) + event->len;
+    }
+
+    return 0;
+}
+
+static void _free_watch_state(watch_state_t *state) {
+    for (size_t i = 0; i < state->dir_path_cap; i++) {
+        free(state->dir_paths[i]);
+    }
+    free(state->dir_paths);
+
+    if (state->notify_fd >= 0) {
+        close(state->notify_fd);
+    }
+}
+
+int exec_cmd_watch(arp_cmd_args_t *args) {
+    int rc = UNINIT_U32;
+
+    watch_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.args = args;
+    state.root_wd = -1;
+
+    // a single descriptor lives for the whole session, since events sent to a closed one would be lost
+    if ((state.notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        rc = errno;
+        arptool_print(args, LogLevelError, "Failed to initialize inotify (errno: %d)\n", rc);
+        return rc;
+    }
+
+    if ((state.root_wd = inotify_add_watch(state.notify_fd, args->src_path, WATCH_MASK)) < 0
+            || (rc = _set_watch_path(&state, state.root_wd, args->src_path)) != 0
+            || (rc = walk_dir(args->src_path, _add_watch, &state)) != 0) {
+        rc = state.root_wd < 0 ? errno : rc;
+        arptool_print(args, LogLevelError, "Failed to watch source directory (errno: %d)\n", rc);
+        _free_watch_state(&state);
+        return rc;
+    }
+
+    exec_cmd_pack(args);
+
+    arptool_print(args, LogLevelInfo, "Watching %s for changes\n", args->src_path);
+
+    struct pollfd poll_fd = { .fd = state.notify_fd, .events = POLLIN, .revents = 0 };
+    while (true) {
+        // block until something happens in the tree
+        if (poll(&poll_fd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rc = errno;
+            break;
+        }
+
+        bool relevant = false;
+        if ((rc = _drain_events(&state, &relevant)) != 0) {
+            break;
+        }
+
+        if (!relevant && !state.root_removed) {
+            continue;
+        }
+
+        // wait for the tree to settle before repacking, since editors and build tools tend to emit bursts
+        while (!state.root_removed && poll(&poll_fd, 1, DEBOUNCE_MS) > 0) {
+            if ((rc = _drain_events(&state, &relevant)) != 0) {
+                break;
+            }
+        }
+
+        if (rc != 0) {
+            break;
+        }
+
+        if (state.root_removed) {
+            arptool_print(args, LogLevelError, "Source directory %s was removed, no longer watching\n",
+                    args->src_path);
+            rc = ENOENT;
+            break;
+        }
+
+        arptool_print(args, LogLevelInfo, "Change detected, repacking\n");
+        exec_cmd_pack(args);
+    }
+
+    _free_watch_state(&state);
+
+    return rc;
+}
+#else
+int exec_cmd_watch(arp_cmd_args_t *args) {
+    arptool_print(args, LogLevelError, "The watch verb is currently only supported on Linux\n");
+    return ENOTSUP;
+}
+#endif
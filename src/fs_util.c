@@ -0,0 +1,377 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+// lstat and st_mtim are POSIX rather than ISO C
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "arena.h"
+#include "file_defines.h"
+#include "fs_util.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#define rmdir _rmdir
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define DIR_MODE 0755
+
+static int _mkdir_single(const char *path) {
+    #ifdef _WIN32
+    int rc = _mkdir(path);
+    #else
+    int rc = mkdir(path, DIR_MODE);
+    #endif
+
+    if (rc != 0 && errno != EEXIST) {
+        return errno;
+    }
+
+    return 0;
+}
+
+static int _mkdirs_from(const char *path, size_t start) {
+    unsigned char scratch_buf[ARENA_SCRATCH_LEN];
+    arp_arena_t scratch;
+    arena_init(&scratch, scratch_buf, sizeof(scratch_buf), 0);
+
+    size_t len = strlen(path);
+    char *buf = NULL;
+    if ((buf = arena_strdup(&scratch, path)) == NULL) {
+        return ENOMEM;
+    }
+
+    int rc = 0;
+    for (size_t i = start; i <= len && rc == 0; i++) {
+        if (i == len || IS_PATH_DELIM(buf[i])) {
+            char orig = buf[i];
+            buf[i] = '\0';
+            rc = _mkdir_single(buf);
+            buf[i] = orig;
+        }
+    }
+
+    arena_free(&scratch);
+
+    return rc;
+}
+
+int mkdirs(const char *path) {
+    // skip the first character so that absolute paths don't attempt to create the root
+    return _mkdirs_from(path, 1);
+}
+
+int mkdirs_below(const char *root, const char *path) {
+    size_t root_len = strlen(root);
+    if (strncmp(path, root, root_len) != 0 || (path[root_len] != '\0' && !IS_PATH_DELIM(path[root_len]))) {
+        return mkdirs(path);
+    }
+
+    return _mkdirs_from(path, root_len + 1);
+}
+
+typedef struct WalkState {
+    walk_callback_t callback;
+    void *user_data;
+    // set when links should be handed to the callback as they are instead of being followed or skipped
+    bool report_links;
+    // cleared when only the root's immediate entries should be visited
+    bool recurse;
+    // one buffer holds the current path for the whole walk, with each level appending to its parent's prefix
+    char *path;
+    size_t path_cap;
+} walk_state_t;
+
+// replaces whatever follows the first dir_len characters of the path buffer with a delimiter and the given name
+static int _set_child_path(walk_state_t *state, size_t dir_len, const char *name, size_t *out_len) {
+    size_t name_len = strlen(name);
+    size_t needed = dir_len + 1 + name_len + 1;
+    if (needed > state->path_cap) {
+        size_t new_cap = state->path_cap > 0 ? state->path_cap : 256;
+        while (new_cap < needed) {
+            new_cap *= 2;
+        }
+
+        char *new_path = NULL;
+        if ((new_path = realloc(state->path, new_cap)) == NULL) {
+            return ENOMEM;
+        }
+        state->path = new_path;
+        state->path_cap = new_cap;
+    }
+
+    state->path[dir_len] = PATH_DELIM;
+    memcpy(state->path + dir_len + 1, name, name_len + 1);
+    *out_len = dir_len + 1 + name_len;
+    return 0;
+}
+
+#ifdef _WIN32
+static int _walk_level(walk_state_t *state, size_t dir_len, bool is_root) {
+    size_t pattern_len = 0;
+    if (_set_child_path(state, dir_len, "*", &pattern_len) != 0) {
+        return ENOMEM;
+    }
+
+    WIN32_FIND_DATAA find_data;
+    HANDLE find_handle = FindFirstFileA(state->path, &find_data);
+    state->path[dir_len] = '\0';
+
+    if (find_handle == INVALID_HANDLE_VALUE) {
+        DWORD err = GetLastError();
+        // a directory removed after it was listed isn't worth failing the whole walk over
+        return !is_root && (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) ? 0 : ENOENT;
+    }
+
+    int rc = 0;
+    do {
+        if (strcmp(find_data.cFileName, ".") == 0 || strcmp(find_data.cFileName, "..") == 0) {
+            continue;
+        }
+
+        size_t child_len = 0;
+        if ((rc = _set_child_path(state, dir_len, find_data.cFileName, &child_len)) != 0) {
+            break;
+        }
+
+        bool is_dir = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        bool is_link = (find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+
+        if (is_dir && is_link) {
+            // directory links and junctions are never entered, so a loop can't send the walk around forever
+            if (state->report_links) {
+                rc = state->callback(state->path, true, 0, state->user_data);
+            }
+        } else if (is_dir) {
+            if ((rc = state->callback(state->path, true, 0, state->user_data)) == 0 && state->recurse) {
+                rc = _walk_level(state, child_len, false);
+            }
+        } else {
+            uint64_t size = ((uint64_t) find_data.nFileSizeHigh << 32) | find_data.nFileSizeLow;
+            rc = state->callback(state->path, false, size, state->user_data);
+        }
+    } while (rc == 0 && FindNextFileA(find_handle, &find_data));
+
+    FindClose(find_handle);
+
+    return rc;
+}
+#else
+static bool _is_vanished_error(int err) {
+    // entries can disappear between readdir and lstat, and links can dangle or loop back on themselves
+    return err == ENOENT || err == ENOTDIR || err == ELOOP;
+}
+
+static int _walk_level(walk_state_t *state, size_t dir_len, bool is_root) {
+    DIR *dir = NULL;
+    if ((dir = opendir(state->path)) == NULL) {
+        int err = errno;
+        return !is_root && _is_vanished_error(err) ? 0 : err;
+    }
+
+    int rc = 0;
+    struct dirent *entry = NULL;
+    while (rc == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        size_t child_len = 0;
+        if ((rc = _set_child_path(state, dir_len, entry->d_name, &child_len)) != 0) {
+            break;
+        }
+
+        struct stat child_stat;
+        if (lstat(state->path, &child_stat) != 0) {
+            rc = _is_vanished_error(errno) ? 0 : errno;
+            continue;
+        }
+
+        if (S_ISLNK(child_stat.st_mode)) {
+            if (state->report_links) {
+                rc = state->callback(state->path, false, 0, state->user_data);
+                continue;
+            }
+
+            // links to files are followed since their contents are what gets packed, but links to directories
+            // never are, so that a loop can't send the walk around forever
+            if (stat(state->path, &child_stat) != 0) {
+                rc = _is_vanished_error(errno) ? 0 : errno;
+            } else if (S_ISREG(child_stat.st_mode)) {
+                rc = state->callback(state->path, false, (uint64_t) child_stat.st_size, state->user_data);
+            }
+        } else if (S_ISDIR(child_stat.st_mode)) {
+            if ((rc = state->callback(state->path, true, 0, state->user_data)) == 0 && state->recurse) {
+                rc = _walk_level(state, child_len, false);
+            }
+        } else if (S_ISREG(child_stat.st_mode)) {
+            rc = state->callback(state->path, false, (uint64_t) child_stat.st_size, state->user_data);
+        }
+    }
+
+    closedir(dir);
+
+    return rc;
+}
+#endif
+
+static int _walk_dir(const char *root, walk_callback_t callback, void *user_data, bool report_links, bool recurse) {
+    walk_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.callback = callback;
+    state.user_data = user_data;
+    state.report_links = report_links;
+    state.recurse = recurse;
+
+    size_t root_len = strlen(root);
+    if ((state.path = malloc(root_len + 1)) == NULL) {
+        return ENOMEM;
+    }
+    state.path_cap = root_len + 1;
+    memcpy(state.path, root, root_len + 1);
+
+    int rc = _walk_level(&state, root_len, true);
+
+    free(state.path);
+
+    return rc;
+}
+
+int walk_dir(const char *root, walk_callback_t callback, void *user_data) {
+    return _walk_dir(root, callback, user_data, false, true);
+}
+
+int list_dir(const char *root, walk_callback_t callback, void *user_data) {
+    return _walk_dir(root, callback, user_data, false, false);
+}
+
+typedef struct DirList {
+    char **paths;
+    size_t count;
+    size_t cap;
+    arp_arena_t strings;
+} dir_list_t;
+
+static int _remove_tree_entry(const char *path, bool is_dir, uint64_t size, void *user_data) {
+    (void) size;
+
+    // links show up here as files, so removing them only removes the link and never what it points to
+    if (!is_dir) {
+        return remove(path) == 0 ? 0 : errno;
+    }
+
+    // directories are reported before their contents, so they have to be removed afterward in reverse order
+    dir_list_t *dirs = user_data;
+    if (dirs->count == dirs->cap) {
+        size_t new_cap = dirs->cap > 0 ? dirs->cap * 2 : 16;
+        char **new_paths = NULL;
+        if ((new_paths = realloc(dirs->paths, new_cap * sizeof(char *))) == NULL) {
+            return ENOMEM;
+        }
+        dirs->paths = new_paths;
+        dirs->cap = new_cap;
+    }
+
+    if ((dirs->paths[dirs->count] = arena_strdup(&dirs->strings, path)) == NULL) {
+        return ENOMEM;
+    }
+    dirs->count += 1;
+
+    return 0;
+}
+
+int remove_tree(const char *root) {
+    #ifndef _WIN32
+    // a link in place of the root is removed by itself rather than emptying the directory it points to
+    struct stat root_stat;
+    if (lstat(root, &root_stat) != 0) {
+        return errno;
+    } else if (S_ISLNK(root_stat.st_mode)) {
+        return unlink(root) == 0 ? 0 : errno;
+    }
+    #endif
+
+    dir_list_t dirs;
+    memset(&dirs, 0, sizeof(dirs));
+    arena_init(&dirs.strings, NULL, 0, 0);
+
+    int rc = _walk_dir(root, _remove_tree_entry, &dirs, true, true);
+
+    for (size_t i = dirs.count; i > 0; i--) {
+        if (rc == 0 && rmdir(dirs.paths[i - 1]) != 0) {
+            rc = errno;
+        }
+    }
+    free(dirs.paths);
+    arena_free(&dirs.strings);
+
+    if (rc == 0 && rmdir(root) != 0) {
+        rc = errno;
+    }
+
+    return rc;
+}
+
+int get_file_stamp(const char *path, arp_file_stamp_t *out_stamp) {
+    struct stat file_stat;
+    if (stat(path, &file_stat) != 0) {
+        return errno;
+    }
+
+    out_stamp->size = (uint64_t) file_stat.st_size;
+    out_stamp->mtime_sec = (int64_t) file_stat.st_mtime;
+    // whole seconds aren't enough, since watch can rewrite a package at the same size several times a second
+    #if defined(_WIN32)
+    out_stamp->mtime_nsec = 0;
+    #elif defined(__APPLE__)
+    out_stamp->mtime_nsec = (int64_t) file_stat.st_mtimespec.tv_nsec;
+    #else
+    out_stamp->mtime_nsec = (int64_t) file_stat.st_mtim.tv_nsec;
+    #endif
+
+    return 0;
+}
+
+int sync_file(const char *path) {
+    #ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return EIO;
+    }
+
+    int rc = FlushFileBuffers(file) ? 0 : EIO;
+    CloseHandle(file);
+    return rc;
+    #else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno;
+    }
+
+    int rc = fsync(fd) == 0 ? 0 : errno;
+    close(fd);
+    return rc;
+    #endif
+}
@@ -10,10 +10,6 @@
 #include "arg_defs.h"
 #include "arg_parse.h"
 #include "cmd_impls.h"
-#include "help.h"
-
-#include "arp/util/defines.h"
-#include "arp/util/error.h"
 
 #include <errno.h>
 #include <signal.h>
@@ -43,51 +39,25 @@ int main(int argc, char **argv) {
         printf("%s\n", parse_err);
 
         free(parse_err);
+        free_args(&args);
 
         return EINVAL;
     }
 
-    if (args.verb != NULL && strcmp(args.verb, VERB_PACK) != 0) {
-        if (args.compression != NULL) {
-            printf("Compression param does not make sense with specified verb\n");
-            return EINVAL;
-        }
-        if (args.mappings_path != NULL) {
-            printf("Mappings path param does not make sense with specified verb\n");
-            return EINVAL;
-        }
-        if (args.package_name != NULL) {
-            printf("Package name param does not make sense with specified verb\n");
-            return EINVAL;
-        }
-        if (args.package_namespace != NULL) {
-            printf("Namespace param does not make sense with specified verb\n");
-            return EINVAL;
-        }
-        if (args.part_size != 0) {
-            printf("Part size param does not make sense with specified verb\n");
-            return EINVAL;
-        }
-    }
+    char *validate_err = validate_args(&args);
+
+    if (validate_err != NULL) {
+        printf("%s\n", validate_err);
+
+        free(validate_err);
+        free_args(&args);
 
-    if (args.package_namespace != NULL && strlen(args.package_namespace) > ARP_NAMESPACE_MAX) {
-        printf("Namespace is too long (max %d chars)\n", ARP_NAMESPACE_MAX);
         return EINVAL;
     }
 
-    if (args.is_help) {
-        return exec_cmd_help(&args);
-    } else if (args.verb != NULL) {
-        if (strcmp(args.verb, VERB_PACK) == 0) {
-            return exec_cmd_pack(&args);
-        } else if (strcmp(args.verb, VERB_UNPACK) == 0) {
-            return exec_cmd_unpack(&args);
-        } else if (strcmp(args.verb, VERB_LIST) == 0) {
-            return exec_cmd_list(&args);
-        }
-    }
+    int rc = exec_cmd(&args);
+
+    free_args(&args);
 
-    printf("Unrecognized verb: %s\n", args.verb);
-    print_general_usage_msg();
-    return EINVAL;
+    return rc;
 }
@@ -0,0 +1,385 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arena.h"
+#include "arg_parse.h"
+#include "file_defines.h"
+#include "fs_util.h"
+#include "misc_defines.h"
+#include "pack_plan.h"
+#include "util.h"
+
+#include "arp/util/defines.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef FEATURE_DEFLATE
+#include <zlib.h>
+#endif
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+// each extension's files are split into this many size strata, and one file is sampled from each
+#define SAMPLE_FILES_PER_GROUP 32
+// only a prefix of each sampled file is compressed, which bounds the cost of sampling very large resources
+#define SAMPLE_BYTES_PER_FILE (1024 * 1024)
+
+#define READ_CHUNK_LEN (64 * 1024)
+
+#define INITIAL_GROUP_CAP 16
+#define INITIAL_FILE_CAP 64
+
+#define NO_EXTENSION_LABEL "(none)"
+
+typedef struct PlanFile {
+    char *path;
+    uint64_t size;
+} plan_file_t;
+
+typedef struct PlanGroup {
+    char *extension;
+    plan_file_t *files;
+    size_t file_count;
+    size_t file_cap;
+    uint64_t total_bytes;
+    size_t sampled_files;
+    uint64_t sampled_bytes;
+    double sample_secs;
+    double est_bytes;
+    double est_secs;
+} plan_group_t;
+
+typedef struct PlanState {
+    plan_group_t *groups;
+    size_t group_count;
+    size_t group_cap;
+    // backs every path and extension string, which all share the lifetime of the plan
+    arp_arena_t strings;
+} plan_state_t;
+
+typedef struct PlanSampler {
+    bool compress;
+    unsigned char *in_buf;
+    unsigned char *out_buf;
+    #ifdef FEATURE_DEFLATE
+    z_stream stream;
+    #endif
+} plan_sampler_t;
+
+static const char *_get_extension(const char *path) {
+    const char *base = path;
+    for (const char *cur = path; *cur != '\0'; cur++) {
+        if (IS_PATH_DELIM(*cur)) {
+            base = cur + 1;
+        }
+    }
+
+    // a leading dot denotes a hidden file rather than an extension
+    const char *dot = strrchr(base, '.');
+    return dot != NULL && dot != base ? dot + 1 : "";
+}
+
+static plan_group_t *_get_group(plan_state_t *state, const char *extension) {
+    // trees tend to use only a handful of distinct extensions, so a linear scan over them is plenty
+    for (size_t i = 0; i < state->group_count; i++) {
+        if (strcmp(state->groups[i].extension, extension) == 0) {
+            return &state->groups[i];
+        }
+    }
+
+    if (state->group_count == state->group_cap) {
+        size_t new_cap = state->group_cap > 0 ? state->group_cap * 2 : INITIAL_GROUP_CAP;
+        plan_group_t *new_groups = NULL;
+        if ((new_groups = realloc(state->groups, new_cap * sizeof(plan_group_t))) == NULL) {
+            return NULL;
+        }
+        state->groups = new_groups;
+        state->group_cap = new_cap;
+    }
+
+    plan_group_t *group = &state->groups[state->group_count];
+    memset(group, 0, sizeof(plan_group_t));
+
+    if ((group->extension = arena_strdup(&state->strings, extension)) == NULL) {
+        return NULL;
+    }
+
+    state->group_count += 1;
+    return group;
+}
+
+static int _add_file(const char *path, bool is_dir, uint64_t size, void *user_data) {
+    if (is_dir) {
+        return 0;
+    }
+
+    plan_state_t *state = user_data;
+
+    plan_group_t *group = NULL;
+    if ((group = _get_group(state, _get_extension(path))) == NULL) {
+        return ENOMEM;
+    }
+
+    if (group->file_count == group->file_cap) {
+        size_t new_cap = group->file_cap > 0 ? group->file_cap * 2 : INITIAL_FILE_CAP;
+        plan_file_t *new_files = NULL;
+        if ((new_files = realloc(group->files, new_cap * sizeof(plan_file_t))) == NULL) {
+            return ENOMEM;
+        }
+        group->files = new_files;
+        group->file_cap = new_cap;
+    }
+
+    plan_file_t *file = &group->files[group->file_count];
+    if ((file->path = arena_strdup(&state->strings, path)) == NULL) {
+        return ENOMEM;
+    }
+    file->size = size;
+
+    group->file_count += 1;
+    group->total_bytes += size;
+    return 0;
+}
+
+static int _compare_files_by_size(const void *a, const void *b) {
+    uint64_t size_a = ((const plan_file_t *) a)->size;
+    uint64_t size_b = ((const plan_file_t *) b)->size;
+    return size_a < size_b ? -1 : (size_a > size_b ? 1 : 0);
+}
+
+static int _compare_groups_by_size(const void *a, const void *b) {
+    uint64_t size_a = ((const plan_group_t *) a)->total_bytes;
+    uint64_t size_b = ((const plan_group_t *) b)->total_bytes;
+    return size_a < size_b ? 1 : (size_a > size_b ? -1 : 0);
+}
+
+// reads (and compresses, if applicable) a prefix of the given file, reporting the number of bytes consumed and produced
+static int _sample_file(plan_sampler_t *sampler, const char *path, uint64_t *out_in_bytes, uint64_t *out_out_bytes) {
+    FILE *file = NULL;
+    if ((file = fopen(path, "rb")) == NULL) {
+        return errno;
+    }
+
+    #ifdef FEATURE_DEFLATE
+    if (sampler->compress && deflateReset(&sampler->stream) != Z_OK) {
+        fclose(file);
+        return EIO;
+    }
+    #endif
+
+    uint64_t in_bytes = 0;
+    uint64_t out_bytes = 0;
+    int rc = 0;
+    bool done = false;
+    while (!done) {
+        size_t to_read = (size_t) MIN((uint64_t) READ_CHUNK_LEN, SAMPLE_BYTES_PER_FILE - in_bytes);
+        size_t read = to_read > 0 ? fread(sampler->in_buf, 1, to_read, file) : 0;
+        if (read < to_read && ferror(file)) {
+            rc = EIO;
+            break;
+        }
+
+        in_bytes += read;
+        done = read < to_read || in_bytes >= SAMPLE_BYTES_PER_FILE;
+
+        if (!sampler->compress) {
+            out_bytes += read;
+            continue;
+        }
+
+        #ifdef FEATURE_DEFLATE
+        sampler->stream.next_in = sampler->in_buf;
+        sampler->stream.avail_in = (uInt) read;
+        int flush = done ? Z_FINISH : Z_NO_FLUSH;
+        do {
+            sampler->stream.next_out = sampler->out_buf;
+            sampler->stream.avail_out = READ_CHUNK_LEN;
+            if (deflate(&sampler->stream, flush) == Z_STREAM_ERROR) {
+                rc = EIO;
+                break;
+            }
+            out_bytes += READ_CHUNK_LEN - sampler->stream.avail_out;
+        } while (sampler->stream.avail_out == 0);
+
+        if (rc != 0) {
+            break;
+        }
+        #endif
+    }
+
+    fclose(file);
+
+    *out_in_bytes = in_bytes;
+    *out_out_bytes = out_bytes;
+    return rc;
+}
+
+static int _sample_group(plan_sampler_t *sampler, plan_group_t *group) {
+    qsort(group->files, group->file_count, sizeof(plan_file_t), _compare_files_by_size);
+
+    // stratifying by size keeps a few very large (or very many small) files from skewing the estimate, and weighting
+    // each sample by its stratum's total size extrapolates in terms of bytes rather than files
+    size_t sample_count = MIN(group->file_count, (size_t) SAMPLE_FILES_PER_GROUP);
+    for (size_t k = 0; k < sample_count; k++) {
+        size_t stratum_start = k * group->file_count / sample_count;
+        size_t stratum_end = (k + 1) * group->file_count / sample_count;
+
+        uint64_t stratum_bytes = 0;
+        for (size_t i = stratum_start; i < stratum_end; i++) {
+            stratum_bytes += group->files[i].size;
+        }
+
+        const plan_file_t *file = &group->files[stratum_start + (stratum_end - stratum_start) / 2];
+
+        uint64_t in_bytes = 0;
+        uint64_t out_bytes = 0;
+        double start = get_monotonic_secs();
+        int rc = UNINIT_U32;
+        if ((rc = _sample_file(sampler, file->path, &in_bytes, &out_bytes)) != 0) {
+            return rc;
+        }
+        group->sample_secs += get_monotonic_secs() - start;
+
+        double ratio = in_bytes > 0 ? (double) out_bytes / (double) in_bytes : 1.0;
+        group->est_bytes += (double) stratum_bytes * ratio;
+        group->sampled_bytes += in_bytes;
+        group->sampled_files += 1;
+    }
+
+    if (group->sampled_bytes > 0 && group->sample_secs > 0) {
+        group->est_secs = (double) group->total_bytes * group->sample_secs / (double) group->sampled_bytes;
+    }
+
+    return 0;
+}
+
+static void _print_plan(const arp_cmd_args_t *args, const plan_state_t *state, uint64_t part_size) {
+    size_t max_ext = strlen("EXTENSION");
+    for (size_t i = 0; i < state->group_count; i++) {
+        const char *ext = state->groups[i].extension;
+        max_ext = MAX(max_ext, strlen(ext[0] != '\0' ? ext : NO_EXTENSION_LABEL));
+    }
+
+    arptool_print(args, LogLevelInfo, "%-*s   %8s   %14s   %8s   %6s   %14s   %10s\n", (int) max_ext, "EXTENSION",
+            "FILES", "BYTES", "SAMPLED", "RATIO", "EST. BYTES", "EST. TIME");
+
+    uint64_t total_files = 0;
+    uint64_t total_bytes = 0;
+    double total_est_bytes = 0;
+    double total_est_secs = 0;
+    for (size_t i = 0; i < state->group_count; i++) {
+        const plan_group_t *group = &state->groups[i];
+        double ratio = group->total_bytes > 0 ? group->est_bytes / (double) group->total_bytes : 1.0;
+
+        arptool_print(args, LogLevelInfo, "%-*s   %8zu   %14llu   %8zu   %6.3f   %14.0f   %9.1fs\n", (int) max_ext,
+                group->extension[0] != '\0' ? group->extension : NO_EXTENSION_LABEL, group->file_count,
+                (unsigned long long) group->total_bytes, group->sampled_files, ratio, group->est_bytes,
+                group->est_secs);
+
+        total_files += group->file_count;
+        total_bytes += group->total_bytes;
+        total_est_bytes += group->est_bytes;
+        total_est_secs += group->est_secs;
+    }
+
+    uint64_t est_parts = 1;
+    if (part_size > 0 && total_est_bytes > (double) part_size) {
+        est_parts = (uint64_t) (total_est_bytes / (double) part_size);
+        if ((double) est_parts * (double) part_size < total_est_bytes) {
+            est_parts += 1;
+        }
+    }
+
+    arptool_print(args, LogLevelInfo, "\n%llu file(s) totaling %llu bytes would pack to ~%.0f bytes "
+            "(ratio %.3f) in ~%llu part(s), taking ~%.1fs\n", (unsigned long long) total_files,
+            (unsigned long long) total_bytes, total_est_bytes,
+            total_bytes > 0 ? total_est_bytes / (double) total_bytes : 1.0, (unsigned long long) est_parts,
+            total_est_secs);
+}
+
+static void _free_state(plan_state_t *state) {
+    for (size_t i = 0; i < state->group_count; i++) {
+        free(state->groups[i].files);
+    }
+    free(state->groups);
+    arena_free(&state->strings);
+}
+
+int plan_pack(const arp_cmd_args_t *args, const char *src_path, const char *compression_magic, uint64_t part_size) {
+    plan_sampler_t sampler;
+    memset(&sampler, 0, sizeof(sampler));
+
+    if (compression_magic != NULL) {
+        #ifdef FEATURE_DEFLATE
+        sampler.compress = strcmp(compression_magic, ARP_COMPRESS_TYPE_DEFLATE) == 0;
+        #endif
+
+        if (!sampler.compress) {
+            arptool_print(args, LogLevelError, "Warning: compression cannot be sampled in this build, "
+                    "size estimates assume no compression\n");
+        }
+    }
+
+    plan_state_t state;
+    memset(&state, 0, sizeof(state));
+    arena_init(&state.strings, NULL, 0, 0);
+
+    int rc = UNINIT_U32;
+    if ((rc = walk_dir(src_path, _add_file, &state)) != 0) {
+        arptool_print(args, LogLevelError, "Failed to scan source directory (rc: %d)\n", rc);
+        _free_state(&state);
+        return rc;
+    }
+
+    if ((sampler.in_buf = malloc(READ_CHUNK_LEN)) == NULL || (sampler.out_buf = malloc(READ_CHUNK_LEN)) == NULL) {
+        rc = ENOMEM;
+    }
+
+    #ifdef FEATURE_DEFLATE
+    bool stream_inited = false;
+    if (rc == 0 && sampler.compress) {
+        if (deflateInit(&sampler.stream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            rc = ENOMEM;
+        } else {
+            stream_inited = true;
+        }
+    }
+    #endif
+
+    // samples are taken serially so that the measured throughput reflects that of a single packing thread
+    for (size_t i = 0; i < state.group_count && rc == 0; i++) {
+        if ((rc = _sample_group(&sampler, &state.groups[i])) != 0) {
+            arptool_print(args, LogLevelError, "Failed to sample files with extension '%s' (rc: %d)\n",
+                    state.groups[i].extension, rc);
+        }
+    }
+
+    if (rc == 0) {
+        qsort(state.groups, state.group_count, sizeof(plan_group_t), _compare_groups_by_size);
+        _print_plan(args, &state, part_size);
+    }
+
+    #ifdef FEATURE_DEFLATE
+    if (stream_inited) {
+        deflateEnd(&sampler.stream);
+    }
+    #endif
+
+    free(sampler.in_buf);
+    free(sampler.out_buf);
+    _free_state(&state);
+
+    return rc;
+}
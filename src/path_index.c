@@ -0,0 +1,408 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "fs_util.h"
+#include "path_index.h"
+
+#include "arp/unpack/list.h"
+#include "arp/unpack/types.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define INDEX_MAGIC "ARPTIDX"
+#define INDEX_VERSION 2
+#define INDEX_BYTE_ORDER_MARK 0x01020304
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// the table is kept at most half full so probe sequences stay short
+#define INDEX_LOAD_FACTOR_INV 2
+
+typedef struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order_mark;
+    uint64_t package_size;
+    int64_t package_mtime_sec;
+    int64_t package_mtime_nsec;
+    uint64_t entry_count;
+    uint64_t bucket_count;
+    uint64_t entries_offset;
+    uint64_t buckets_offset;
+    uint64_t strings_offset;
+    uint64_t strings_len;
+} index_header_t;
+
+typedef struct IndexEntry {
+    uint64_t path_off;
+    uint64_t media_type_off;
+    uint32_t path_len;
+    uint32_t media_type_len;
+} index_entry_t;
+
+typedef struct IndexBucket {
+    uint64_t hash;
+    // 1-based so that a zeroed bucket reads as empty
+    uint64_t entry_num;
+} index_bucket_t;
+
+_Static_assert(sizeof(index_header_t) == 88, "Unexpected index header size");
+_Static_assert(sizeof(index_entry_t) == 24, "Unexpected index entry size");
+_Static_assert(sizeof(index_bucket_t) == 16, "Unexpected index bucket size");
+
+static uint64_t _hash_path(const char *path, size_t len) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) path[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+char *get_index_path(const char *package_path) {
+    size_t path_len = strlen(package_path) + sizeof(INDEX_FILE_SUFFIX);
+    char *index_path = NULL;
+    if ((index_path = malloc(path_len)) == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    snprintf(index_path, path_len, "%s" INDEX_FILE_SUFFIX, package_path);
+    return index_path;
+}
+
+int write_path_index(ConstArpPackage package, const char *package_path) {
+    index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.byte_order_mark = INDEX_BYTE_ORDER_MARK;
+
+    arp_file_stamp_t package_stamp;
+    int rc = 0;
+    if ((rc = get_file_stamp(package_path, &package_stamp)) != 0) {
+        return rc;
+    }
+    header.package_size = package_stamp.size;
+    header.package_mtime_sec = package_stamp.mtime_sec;
+    header.package_mtime_nsec = package_stamp.mtime_nsec;
+
+    arp_resource_listing_t *listings = NULL;
+    size_t listing_count = 0;
+    if ((rc = arp_get_resource_listing(package, &listings, &listing_count)) != 0) {
+        return rc;
+    }
+
+    size_t bucket_count = 1;
+    while (bucket_count < listing_count * INDEX_LOAD_FACTOR_INV) {
+        bucket_count <<= 1;
+    }
+
+    index_entry_t *entries = calloc(listing_count > 0 ? listing_count : 1, sizeof(index_entry_t));
+    index_bucket_t *buckets = calloc(bucket_count, sizeof(index_bucket_t));
+    if (entries == NULL || buckets == NULL) {
+        free(entries);
+        free(buckets);
+        arp_free_resource_listing(listings, listing_count);
+        return ENOMEM;
+    }
+
+    uint64_t strings_len = 0;
+    for (size_t i = 0; i < listing_count; i++) {
+        arp_resource_listing_t *listing = &listings[i];
+        index_entry_t *entry = &entries[i];
+
+        entry->path_len = (uint32_t) strlen(listing->path);
+        entry->media_type_len = (uint32_t) strlen(listing->meta.media_type);
+        entry->path_off = strings_len;
+        strings_len += entry->path_len + 1;
+        entry->media_type_off = strings_len;
+        strings_len += entry->media_type_len + 1;
+
+        uint64_t hash = _hash_path(listing->path, entry->path_len);
+        size_t slot = (size_t) (hash & (bucket_count - 1));
+        while (buckets[slot].entry_num != 0) {
+            slot = (slot + 1) & (bucket_count - 1);
+        }
+        buckets[slot].hash = hash;
+        buckets[slot].entry_num = i + 1;
+    }
+
+    header.entry_count = listing_count;
+    header.bucket_count = bucket_count;
+    header.entries_offset = sizeof(index_header_t);
+    header.buckets_offset = header.entries_offset + listing_count * sizeof(index_entry_t);
+    header.strings_offset = header.buckets_offset + bucket_count * sizeof(index_bucket_t);
+    header.strings_len = strings_len;
+
+    char *index_path = NULL;
+    FILE *index_file = NULL;
+    if ((index_path = get_index_path(package_path)) == NULL) {
+        rc = ENOMEM;
+    } else if ((index_file = fopen(index_path, "wb")) == NULL) {
+        rc = errno;
+    }
+
+    if (rc == 0) {
+        bool ok = fwrite(&header, sizeof(header), 1, index_file) == 1
+                && fwrite(entries, sizeof(index_entry_t), listing_count, index_file) == listing_count
+                && fwrite(buckets, sizeof(index_bucket_t), bucket_count, index_file) == bucket_count;
+
+        for (size_t i = 0; ok && i < listing_count; i++) {
+            ok = fwrite(listings[i].path, 1, entries[i].path_len + 1, index_file) == entries[i].path_len + 1
+                    && fwrite(listings[i].meta.media_type, 1, entries[i].media_type_len + 1, index_file)
+                            == entries[i].media_type_len + 1;
+        }
+
+        if (fclose(index_file) != 0 || !ok) {
+            rc = EIO;
+            remove(index_path);
+        }
+    }
+
+    free(index_path);
+    free(entries);
+    free(buckets);
+    arp_free_resource_listing(listings, listing_count);
+
+    return rc;
+}
+
+// checks that count elements of elem_len bytes starting at offset end at or before limit, without letting values read
+// from the file wrap the arithmetic
+static bool _region_fits(uint64_t offset, uint64_t count, uint64_t elem_len, uint64_t limit) {
+    return offset <= limit && count <= (limit - offset) / elem_len;
+}
+
+static bool _validate_index(const arp_path_index_t *index, const arp_file_stamp_t *package_stamp) {
+    if (index->data_len < sizeof(index_header_t)) {
+        return false;
+    }
+
+    const index_header_t *header = (const index_header_t *) index->data;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+            || header->version != INDEX_VERSION
+            || header->byte_order_mark != INDEX_BYTE_ORDER_MARK) {
+        return false;
+    }
+
+    // a stale index is treated the same as a missing one
+    if (header->package_size != package_stamp->size || header->package_mtime_sec != package_stamp->mtime_sec
+            || header->package_mtime_nsec != package_stamp->mtime_nsec) {
+        return false;
+    }
+
+    if (header->bucket_count == 0 || (header->bucket_count & (header->bucket_count - 1)) != 0) {
+        return false;
+    }
+
+    // the tables are accessed in place, so their offsets must also be suitably aligned
+    if (header->entries_offset < sizeof(index_header_t)
+            || header->entries_offset % _Alignof(index_entry_t) != 0
+            || header->buckets_offset % _Alignof(index_bucket_t) != 0) {
+        return false;
+    }
+
+    return _region_fits(header->entries_offset, header->entry_count, sizeof(index_entry_t), header->buckets_offset)
+            && _region_fits(header->buckets_offset, header->bucket_count, sizeof(index_bucket_t),
+                    header->strings_offset)
+            && _region_fits(header->strings_offset, header->strings_len, 1, (uint64_t) index->data_len);
+}
+
+int open_path_index(const char *package_path, arp_path_index_t *out_index) {
+    memset(out_index, 0, sizeof(arp_path_index_t));
+
+    arp_file_stamp_t package_stamp;
+    int rc = 0;
+    if ((rc = get_file_stamp(package_path, &package_stamp)) != 0) {
+        return rc;
+    }
+
+    char *index_path = NULL;
+    if ((index_path = get_index_path(package_path)) == NULL) {
+        return ENOMEM;
+    }
+
+    #ifdef _WIN32
+    FILE *index_file = NULL;
+    if ((index_file = fopen(index_path, "rb")) == NULL) {
+        rc = errno;
+        free(index_path);
+        return rc;
+    }
+    free(index_path);
+
+    struct stat index_stat;
+    if (fstat(fileno(index_file), &index_stat) != 0) {
+        rc = errno;
+        fclose(index_file);
+        return rc;
+    }
+
+    unsigned char *data = NULL;
+    size_t data_len = (size_t) index_stat.st_size;
+    if ((data = malloc(data_len > 0 ? data_len : 1)) == NULL) {
+        fclose(index_file);
+        return ENOMEM;
+    }
+
+    if (fread(data, 1, data_len, index_file) != data_len) {
+        free(data);
+        fclose(index_file);
+        return EIO;
+    }
+    fclose(index_file);
+
+    out_index->data = data;
+    out_index->data_len = data_len;
+    out_index->mapped = false;
+    #else
+    int fd = open(index_path, O_RDONLY);
+    if (fd < 0) {
+        rc = errno;
+        free(index_path);
+        return rc;
+    }
+    free(index_path);
+
+    struct stat index_stat;
+    if (fstat(fd, &index_stat) != 0) {
+        rc = errno;
+        close(fd);
+        return rc;
+    }
+
+    size_t data_len = (size_t) index_stat.st_size;
+    if (data_len == 0) {
+        close(fd);
+        return EINVAL;
+    }
+
+    // the index is laid out so that it can be used in-place, so pages are only faulted in as lookups touch them
+    void *data = mmap(NULL, data_len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return errno;
+    }
+
+    out_index->data = data;
+    out_index->data_len = data_len;
+    out_index->mapped = true;
+    #endif
+
+    if (!_validate_index(out_index, &package_stamp)) {
+        close_path_index(out_index);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+void close_path_index(arp_path_index_t *index) {
+    if (index->data == NULL) {
+        return;
+    }
+
+    #ifndef _WIN32
+    if (index->mapped) {
+        munmap((void *) index->data, index->data_len);
+    } else {
+        free((void *) index->data);
+    }
+    #else
+    free((void *) index->data);
+    #endif
+
+    index->data = NULL;
+    index->data_len = 0;
+}
+
+// strings are handed out as C strings, so each one must lie within the string table and carry its terminator
+static bool _is_string_valid(const index_header_t *header, const char *strings, uint64_t off, uint64_t len) {
+    return off < header->strings_len && len < header->strings_len - off && strings[off + len] == '\0';
+}
+
+static bool _read_entry(const index_header_t *header, const index_entry_t *entry, const char *strings,
+        arp_path_index_entry_t *out_entry) {
+    if (!_is_string_valid(header, strings, entry->path_off, entry->path_len)
+            || !_is_string_valid(header, strings, entry->media_type_off, entry->media_type_len)) {
+        return false;
+    }
+
+    if (out_entry != NULL) {
+        out_entry->path = strings + entry->path_off;
+        out_entry->path_len = entry->path_len;
+        out_entry->media_type = strings + entry->media_type_off;
+        out_entry->media_type_len = entry->media_type_len;
+    }
+    return true;
+}
+
+size_t get_path_index_entry_count(const arp_path_index_t *index) {
+    return (size_t) ((const index_header_t *) index->data)->entry_count;
+}
+
+bool get_path_index_entry(const arp_path_index_t *index, size_t entry_index, arp_path_index_entry_t *out_entry) {
+    const index_header_t *header = (const index_header_t *) index->data;
+    const index_entry_t *entries = (const index_entry_t *) (index->data + header->entries_offset);
+    const char *strings = (const char *) (index->data + header->strings_offset);
+
+    if (entry_index >= header->entry_count) {
+        return false;
+    }
+
+    return _read_entry(header, &entries[entry_index], strings, out_entry);
+}
+
+bool find_in_path_index(const arp_path_index_t *index, const char *path, arp_path_index_entry_t *out_entry) {
+    const index_header_t *header = (const index_header_t *) index->data;
+    const index_entry_t *entries = (const index_entry_t *) (index->data + header->entries_offset);
+    const index_bucket_t *buckets = (const index_bucket_t *) (index->data + header->buckets_offset);
+    const char *strings = (const char *) (index->data + header->strings_offset);
+
+    size_t path_len = strlen(path);
+    uint64_t hash = _hash_path(path, path_len);
+    uint64_t mask = header->bucket_count - 1;
+
+    for (uint64_t slot = hash & mask, probes = 0; probes < header->bucket_count; slot = (slot + 1) & mask, probes++) {
+        const index_bucket_t *bucket = &buckets[slot];
+        if (bucket->entry_num == 0 || bucket->entry_num > header->entry_count) {
+            return false;
+        }
+
+        if (bucket->hash != hash) {
+            continue;
+        }
+
+        const index_entry_t *entry = &entries[bucket->entry_num - 1];
+        if (entry->path_len != path_len || !_is_string_valid(header, strings, entry->path_off, path_len)
+                || memcmp(strings + entry->path_off, path, path_len) != 0) {
+            continue;
+        }
+
+        return _read_entry(header, entry, strings, out_entry);
+    }
+
+    return false;
+}
@@ -0,0 +1,129 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arena.h"
+#include "arg_parse.h"
+#include "progress.h"
+#include "util.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define IS_STDERR_TTY() (_isatty(_fileno(stderr)) != 0)
+#else
+#include <unistd.h>
+#define IS_STDERR_TTY() (isatty(STDERR_FILENO) != 0)
+#endif
+
+#define TTY_RENDER_INTERVAL 0.25
+#define JSON_RENDER_INTERVAL 1.0
+
+#define BYTES_PER_MIB (1024.0 * 1024.0)
+#define SECS_PER_MIN 60
+#define SECS_PER_HOUR 3600
+
+static void _render(const arp_progress_t *progress, double now, const arp_alloc_stats_t *final_stats) {
+    bool final = final_stats != NULL;
+
+    double elapsed = now - progress->start_time;
+    double rate = elapsed > 0 ? (double) progress->done_bytes / elapsed : 0;
+
+    long eta = -1;
+    if (rate > 0 && progress->total_bytes >= progress->done_bytes) {
+        eta = (long) ((double) (progress->total_bytes - progress->done_bytes) / rate);
+    } else if (progress->done_files > 0 && progress->total_files >= progress->done_files && elapsed > 0) {
+        // no byte counts are available, so extrapolate from the file count instead
+        double file_rate = (double) progress->done_files / elapsed;
+        eta = (long) ((double) (progress->total_files - progress->done_files) / file_rate);
+    }
+
+    if (progress->json) {
+        fprintf(stderr, "{\"files\":%llu,\"total_files\":%llu,\"bytes\":%llu,\"total_bytes\":%llu,"
+                "\"bytes_per_sec\":%.0f,\"eta_secs\":%ld,\"done\":%s",
+                (unsigned long long) progress->done_files, (unsigned long long) progress->total_files,
+                (unsigned long long) progress->done_bytes, (unsigned long long) progress->total_bytes,
+                rate, eta, final ? "true" : "false");
+        if (final) {
+            fprintf(stderr, ",\"arena_allocs\":%llu,\"arena_blocks\":%llu,\"peak_arena_block_bytes\":%llu,"
+                    "\"peak_rss_bytes\":%llu",
+                    (unsigned long long) final_stats->arena_allocs, (unsigned long long) final_stats->arena_blocks,
+                    (unsigned long long) final_stats->peak_arena_block_bytes,
+                    (unsigned long long) final_stats->peak_rss_bytes);
+        }
+        fputs("}\n", stderr);
+    } else {
+        char eta_str[32] = "--:--:--";
+        if (eta >= 0) {
+            snprintf(eta_str, sizeof(eta_str), "%ld:%02ld:%02ld",
+                    eta / SECS_PER_HOUR, (eta % SECS_PER_HOUR) / SECS_PER_MIN, eta % SECS_PER_MIN);
+        }
+
+        fprintf(stderr, "\r%llu/%llu files", (unsigned long long) progress->done_files,
+                (unsigned long long) progress->total_files);
+        if (progress->total_bytes > 0) {
+            fprintf(stderr, ", %.1f/%.1f MiB, %.1f MiB/s", (double) progress->done_bytes / BYTES_PER_MIB,
+                    (double) progress->total_bytes / BYTES_PER_MIB, rate / BYTES_PER_MIB);
+        }
+        fprintf(stderr, ", ETA %s   ", eta_str);
+
+        if (final) {
+            fprintf(stderr, "\n%llu arena allocations in %llu arena blocks, peak arena blocks %.1f MiB "
+                    "(arena memory only), peak RSS %.1f MiB\n",
+                    (unsigned long long) final_stats->arena_allocs, (unsigned long long) final_stats->arena_blocks,
+                    (double) final_stats->peak_arena_block_bytes / BYTES_PER_MIB,
+                    (double) final_stats->peak_rss_bytes / BYTES_PER_MIB);
+        }
+    }
+
+    fflush(stderr);
+}
+
+void progress_init(arp_progress_t *progress, const arp_cmd_args_t *args, uint64_t total_files, uint64_t total_bytes) {
+    memset(progress, 0, sizeof(arp_progress_t));
+
+    progress->enabled = args->show_progress && args->verbosity != VerbositySilent;
+    progress->json = !IS_STDERR_TTY();
+    progress->total_files = total_files;
+    progress->total_bytes = total_bytes;
+    progress->start_time = get_monotonic_secs();
+    progress->next_render_time = progress->start_time;
+}
+
+void progress_update(arp_progress_t *progress, uint64_t files, uint64_t bytes) {
+    progress->done_files += files;
+    progress->done_bytes += bytes;
+
+    if (!progress->enabled) {
+        return;
+    }
+
+    double now = get_monotonic_secs();
+    if (now < progress->next_render_time) {
+        return;
+    }
+
+    progress->next_render_time = now + (progress->json ? JSON_RENDER_INTERVAL : TTY_RENDER_INTERVAL);
+    _render(progress, now, NULL);
+}
+
+void progress_finish(arp_progress_t *progress) {
+    if (!progress->enabled) {
+        return;
+    }
+
+    // the final report doubles as instrumentation, so it carries the process-wide allocation counters too
+    arp_alloc_stats_t stats;
+    get_alloc_stats(&stats);
+
+    _render(progress, get_monotonic_secs(), &stats);
+}
@@ -0,0 +1,162 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "thread_pool.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef struct PoolState {
+    size_t task_count;
+    size_t next_task;
+    pool_task_fn_t task_fn;
+    void *user_data;
+    #ifdef _WIN32
+    CRITICAL_SECTION lock;
+    #else
+    pthread_mutex_t lock;
+    #endif
+} pool_state_t;
+
+static void _lock_pool(pool_state_t *pool) {
+    #ifdef _WIN32
+    EnterCriticalSection(&pool->lock);
+    #else
+    pthread_mutex_lock(&pool->lock);
+    #endif
+}
+
+static void _unlock_pool(pool_state_t *pool) {
+    #ifdef _WIN32
+    LeaveCriticalSection(&pool->lock);
+    #else
+    pthread_mutex_unlock(&pool->lock);
+    #endif
+}
+
+static void _run_worker(pool_state_t *pool) {
+    while (true) {
+        // workers pull tasks in order, so callers control scheduling by how they order their tasks
+        _lock_pool(pool);
+        size_t task_index = pool->next_task;
+        if (task_index < pool->task_count) {
+            pool->next_task += 1;
+        }
+        _unlock_pool(pool);
+
+        if (task_index >= pool->task_count) {
+            break;
+        }
+
+        pool->task_fn(task_index, pool->user_data);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI _worker_main(LPVOID arg) {
+    _run_worker(arg);
+    return 0;
+}
+#else
+static void *_worker_main(void *arg) {
+    _run_worker(arg);
+    return NULL;
+}
+#endif
+
+size_t get_cpu_count(void) {
+    #ifdef _WIN32
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    return sys_info.dwNumberOfProcessors > 0 ? (size_t) sys_info.dwNumberOfProcessors : 1;
+    #else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t) count : 1;
+    #endif
+}
+
+int run_task_pool(size_t task_count, size_t worker_count, pool_task_fn_t task_fn, void *user_data) {
+    pool_state_t pool;
+    pool.task_count = task_count;
+    pool.next_task = 0;
+    pool.task_fn = task_fn;
+    pool.user_data = user_data;
+
+    if (worker_count > task_count) {
+        worker_count = task_count;
+    }
+
+    // the calling thread acts as a worker too, so a single worker never spawns any threads
+    if (worker_count <= 1) {
+        for (size_t i = 0; i < task_count; i++) {
+            task_fn(i, user_data);
+        }
+        return 0;
+    }
+
+    size_t thread_count = worker_count - 1;
+
+    #ifdef _WIN32
+    HANDLE *threads = NULL;
+    if ((threads = calloc(thread_count, sizeof(HANDLE))) == NULL) {
+        return ENOMEM;
+    }
+    InitializeCriticalSection(&pool.lock);
+    #else
+    pthread_t *threads = NULL;
+    if ((threads = calloc(thread_count, sizeof(pthread_t))) == NULL) {
+        return ENOMEM;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    #endif
+
+    size_t started = 0;
+    for (; started < thread_count; started++) {
+        #ifdef _WIN32
+        if ((threads[started] = CreateThread(NULL, 0, _worker_main, &pool, 0, NULL)) == NULL) {
+            break;
+        }
+        #else
+        if (pthread_create(&threads[started], NULL, _worker_main, &pool) != 0) {
+            break;
+        }
+        #endif
+    }
+
+    // if some threads failed to start, the remaining workers simply pick up the slack
+    _run_worker(&pool);
+
+    for (size_t i = 0; i < started; i++) {
+        #ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+        #else
+        pthread_join(threads[i], NULL);
+        #endif
+    }
+
+    #ifdef _WIN32
+    DeleteCriticalSection(&pool.lock);
+    #else
+    pthread_mutex_destroy(&pool.lock);
+    #endif
+
+    free(threads);
+
+    return 0;
+}
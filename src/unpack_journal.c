@@ -0,0 +1,281 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+// fileno and fsync are POSIX rather than ISO C
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "file_defines.h"
+#include "fs_util.h"
+#include "unpack_journal.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define fileno _fileno
+#define fsync _commit
+#else
+#include <unistd.h>
+#endif
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+#define JOURNAL_MAGIC "ARPTJRNL"
+#define JOURNAL_VERSION 2
+#define JOURNAL_HEADER_FORMAT JOURNAL_MAGIC " %d %llu %lld.%09lld\n"
+#define JOURNAL_HEADER_MAX_LEN 96
+
+#define JOURNAL_TEMP_SUFFIX ".tmp"
+
+// entries only need to reach the kernel to survive the process being killed, so the journal itself is only flushed to
+// disk periodically - an entry lost to a power failure just means that resource gets extracted again
+#define JOURNAL_SYNC_INTERVAL 256
+
+static int _compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static char *_get_journal_path(const char *output_root, const char *package_path, const char *suffix) {
+    #ifdef _WIN32
+    const char *delim = MAX(strrchr(package_path, WIN32_PATH_DELIM), strrchr(package_path, UNIX_PATH_DELIM));
+    #else
+    const char *delim = strrchr(package_path, PATH_DELIM);
+    #endif
+    const char *base = delim != NULL ? delim + 1 : package_path;
+
+    size_t len = strlen(output_root) + 2 + strlen(base) + strlen(JOURNAL_FILE_SUFFIX) + strlen(suffix) + 1;
+    char *path = NULL;
+    if ((path = malloc(len)) == NULL) {
+        return NULL;
+    }
+
+    snprintf(path, len, "%s%c.%s" JOURNAL_FILE_SUFFIX "%s", output_root, PATH_DELIM, base, suffix);
+    return path;
+}
+
+static int _format_header(const char *package_path, char *out_header, size_t header_cap) {
+    // the journal is tied to a specific build of the package, since paths alone can't tell us if content changed
+    arp_file_stamp_t package_stamp;
+    int rc = 0;
+    if ((rc = get_file_stamp(package_path, &package_stamp)) != 0) {
+        return rc;
+    }
+
+    snprintf(out_header, header_cap, JOURNAL_HEADER_FORMAT, JOURNAL_VERSION, (unsigned long long) package_stamp.size,
+            (long long) package_stamp.mtime_sec, (long long) package_stamp.mtime_nsec);
+    return 0;
+}
+
+static int _read_journal(const char *journal_path, char **out_contents, size_t *out_len) {
+    *out_contents = NULL;
+    *out_len = 0;
+
+    FILE *journal_file = NULL;
+    if ((journal_file = fopen(journal_path, "rb")) == NULL) {
+        return errno == ENOENT ? 0 : errno;
+    }
+
+    struct stat journal_stat;
+    if (stat(journal_path, &journal_stat) != 0) {
+        int rc = errno;
+        fclose(journal_file);
+        return rc;
+    }
+
+    size_t len = (size_t) journal_stat.st_size;
+    char *contents = NULL;
+    if ((contents = malloc(len + 1)) == NULL) {
+        fclose(journal_file);
+        return ENOMEM;
+    }
+
+    len = fread(contents, 1, len, journal_file);
+    contents[len] = '\0';
+    fclose(journal_file);
+
+    *out_contents = contents;
+    *out_len = len;
+    return 0;
+}
+
+// splits the entries following the header into NUL-terminated strings in place, dropping any torn final line
+static int _parse_entries(arp_unpack_journal_t *journal, char *entries, size_t len) {
+    size_t line_count = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (entries[i] == '\n') {
+            line_count += 1;
+        }
+    }
+
+    if (line_count == 0) {
+        return 0;
+    }
+
+    if ((journal->completed = malloc(line_count * sizeof(char *))) == NULL) {
+        return ENOMEM;
+    }
+
+    char *line = entries;
+    char *newline = NULL;
+    while ((newline = memchr(line, '\n', len - (size_t) (line - entries))) != NULL) {
+        *newline = '\0';
+        if (newline > line) {
+            journal->completed[journal->completed_count++] = line;
+        }
+        line = newline + 1;
+    }
+
+    qsort(journal->completed, journal->completed_count, sizeof(char *), _compare_paths);
+    return 0;
+}
+
+// rewrites the journal with only its intact entries so that subsequent appends never land on a torn line
+static int _rewrite_journal(const arp_unpack_journal_t *journal, const char *temp_path, const char *header) {
+    FILE *temp_file = NULL;
+    if ((temp_file = fopen(temp_path, "wb")) == NULL) {
+        return errno;
+    }
+
+    int rc = 0;
+    if (fputs(header, temp_file) < 0) {
+        rc = EIO;
+    }
+
+    for (size_t i = 0; i < journal->completed_count && rc == 0; i++) {
+        if (fprintf(temp_file, "%s\n", journal->completed[i]) < 0) {
+            rc = EIO;
+        }
+    }
+
+    if (fclose(temp_file) != 0 && rc == 0) {
+        rc = errno;
+    }
+
+    if (rc == 0) {
+        rc = sync_file(temp_path);
+    }
+
+    #ifdef _WIN32
+    // rename won't replace an existing file on Windows
+    if (rc == 0) {
+        remove(journal->path);
+    }
+    #endif
+
+    if (rc == 0 && rename(temp_path, journal->path) != 0) {
+        rc = errno;
+    }
+
+    if (rc != 0) {
+        remove(temp_path);
+    }
+
+    return rc;
+}
+
+int open_unpack_journal(const char *output_root, const char *package_path, arp_unpack_journal_t *out_journal) {
+    memset(out_journal, 0, sizeof(arp_unpack_journal_t));
+
+    char header[JOURNAL_HEADER_MAX_LEN];
+    int rc = 0;
+    if ((rc = _format_header(package_path, header, sizeof(header))) != 0) {
+        return rc;
+    }
+
+    char *temp_path = NULL;
+    if ((out_journal->path = _get_journal_path(output_root, package_path, "")) == NULL
+            || (temp_path = _get_journal_path(output_root, package_path, JOURNAL_TEMP_SUFFIX)) == NULL) {
+        free(out_journal->path);
+        return ENOMEM;
+    }
+
+    size_t contents_len = 0;
+    if ((rc = _read_journal(out_journal->path, &out_journal->contents, &contents_len)) == 0
+            && out_journal->contents != NULL) {
+        size_t header_len = strlen(header);
+        // a journal left by a different package (or a different build of this one) is worthless, so start over
+        if (contents_len >= header_len && memcmp(out_journal->contents, header, header_len) == 0) {
+            rc = _parse_entries(out_journal, out_journal->contents + header_len, contents_len - header_len);
+        }
+    }
+
+    if (rc == 0) {
+        rc = _rewrite_journal(out_journal, temp_path, header);
+    }
+
+    free(temp_path);
+
+    if (rc == 0 && (out_journal->file = fopen(out_journal->path, "ab")) == NULL) {
+        rc = errno;
+    }
+
+    if (rc != 0) {
+        close_unpack_journal(out_journal, false);
+    }
+
+    return rc;
+}
+
+bool is_resource_journaled(const arp_unpack_journal_t *journal, const char *res_path) {
+    if (journal->completed_count == 0) {
+        return false;
+    }
+
+    return bsearch(&res_path, journal->completed, journal->completed_count, sizeof(char *), _compare_paths) != NULL;
+}
+
+int journal_resource(arp_unpack_journal_t *journal, const char *res_path) {
+    // flushing hands the entry to the kernel right away, and a torn final line is dropped when the journal is read back
+    int rc = 0;
+    if (fprintf(journal->file, "%s\n", res_path) < 0 || fflush(journal->file) != 0) {
+        rc = EIO;
+    }
+
+    if (rc == 0 && ++journal->unsynced_count >= JOURNAL_SYNC_INTERVAL) {
+        rc = fsync(fileno(journal->file)) == 0 ? 0 : errno;
+        journal->unsynced_count = 0;
+    }
+
+    return rc;
+}
+
+int close_unpack_journal(arp_unpack_journal_t *journal, bool discard) {
+    int rc = 0;
+    if (journal->file != NULL) {
+        if (!discard && journal->unsynced_count > 0 && fsync(fileno(journal->file)) != 0) {
+            rc = errno;
+        }
+        fclose(journal->file);
+        journal->file = NULL;
+    }
+
+    if (discard && journal->path != NULL && remove(journal->path) != 0 && errno != ENOENT) {
+        rc = errno;
+    }
+
+    free(journal->completed);
+    free(journal->contents);
+    free(journal->path);
+
+    journal->completed = NULL;
+    journal->contents = NULL;
+    journal->path = NULL;
+    journal->completed_count = 0;
+
+    return rc;
+}
@@ -0,0 +1,243 @@
+/*
+ * This file is a part of libarp.
+ * Copyright (c) 2020-2022, Max Roncace <mproncace@protonmail.com>
+ *
+ * This software is made available under the MIT license. You should have
+ * received a copy of the full license text with this software. If not, the
+ * license text may be accessed at https://opensource.org/licenses/MIT.
+ */
+
+#include "arena.h"
+#include "file_defines.h"
+#include "fs_util.h"
+#include "unpack_util.h"
+
+#include "arp/unpack/resource.h"
+#include "arp/unpack/types.h"
+#include "arp/unpack/unpack.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NAMESPACE_DELIM ':'
+#define ARP_PATH_DELIM '/'
+
+#define STREAM_CHUNK_LEN (256 * 1024)
+
+// appended to the resource's file name with the range's start and (exclusive) end offsets
+#define RANGE_FILE_SUFFIX_FORMAT ".%llu-%llu.range"
+
+char *get_resource_output_dir(arp_arena_t *arena, const char *output_root, const char *res_path) {
+    // ARP paths take the form <namespace>:<dir>/<base name>, and the namespace becomes the top-level directory
+    // to match the layout produced by arp_unpack_to_fs
+    const char *ns_delim = strchr(res_path, NAMESPACE_DELIM);
+    const char *last_delim = strrchr(res_path, ARP_PATH_DELIM);
+
+    size_t ns_len = ns_delim != NULL ? (size_t) (ns_delim - res_path) : 0;
+    const char *dir_start = ns_delim != NULL ? ns_delim + 1 : res_path;
+    size_t dir_len = last_delim != NULL && last_delim > dir_start ? (size_t) (last_delim - dir_start) : 0;
+
+    size_t out_len = strlen(output_root) + 1 + ns_len + 1 + dir_len + 1;
+    char *out_dir = NULL;
+    if ((out_dir = arena_alloc(arena, out_len)) == NULL) {
+        return NULL;
+    }
+
+    size_t off = (size_t) snprintf(out_dir, out_len, "%s", output_root);
+    if (ns_len > 0) {
+        off += (size_t) snprintf(out_dir + off, out_len - off, "%c%.*s", PATH_DELIM, (int) ns_len, res_path);
+    }
+    if (dir_len > 0) {
+        off += (size_t) snprintf(out_dir + off, out_len - off, "%c%.*s", PATH_DELIM, (int) dir_len, dir_start);
+    }
+
+    for (size_t i = strlen(output_root); i < off; i++) {
+        if (out_dir[i] == ARP_PATH_DELIM) {
+            out_dir[i] = PATH_DELIM;
+        }
+    }
+
+    return out_dir;
+}
+
+void output_dir_cache_init(arp_output_dir_cache_t *cache) {
+    arena_init(&cache->arena, NULL, 0, 0);
+    cache->last_dir = NULL;
+}
+
+void output_dir_cache_free(arp_output_dir_cache_t *cache) {
+    arena_free(&cache->arena);
+    cache->last_dir = NULL;
+}
+
+int ensure_output_dir(arp_output_dir_cache_t *cache, const char *output_root, const char *out_dir) {
+    if (cache != NULL && cache->last_dir != NULL && strcmp(cache->last_dir, out_dir) == 0) {
+        return 0;
+    }
+
+    int rc = 0;
+    if ((rc = mkdirs_below(output_root, out_dir)) != 0) {
+        return rc;
+    }
+
+    if (cache != NULL) {
+        arena_reset(&cache->arena);
+        if ((cache->last_dir = arena_strdup(&cache->arena, out_dir)) == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+int unpack_listing_to_fs(const arp_resource_listing_t *listing, const char *output_root,
+        arp_output_dir_cache_t *dir_cache) {
+    unsigned char scratch[ARENA_SCRATCH_LEN];
+    arp_arena_t arena;
+    arena_init(&arena, scratch, sizeof(scratch), 0);
+
+    char *out_dir = NULL;
+    if ((out_dir = get_resource_output_dir(&arena, output_root, listing->path)) == NULL) {
+        arena_free(&arena);
+        return ENOMEM;
+    }
+
+    int rc = 0;
+    if ((rc = ensure_output_dir(dir_cache, output_root, out_dir)) == 0) {
+        rc = arp_unpack_resource_to_fs(&listing->meta, out_dir);
+    }
+
+    arena_free(&arena);
+
+    return rc;
+}
+
+char *get_resource_output_file(arp_arena_t *arena, const char *output_dir, const arp_resource_meta_t *meta) {
+    bool has_ext = meta->extension != NULL && meta->extension[0] != '\0';
+
+    size_t out_len = strlen(output_dir) + 1 + strlen(meta->base_name) + 1
+            + (has_ext ? strlen(meta->extension) : 0) + 1;
+    char *out_file = NULL;
+    if ((out_file = arena_alloc(arena, out_len)) == NULL) {
+        return NULL;
+    }
+
+    if (has_ext) {
+        snprintf(out_file, out_len, "%s%c%s%c%s", output_dir, PATH_DELIM, meta->base_name, EXTENSION_DELIM,
+                meta->extension);
+    } else {
+        snprintf(out_file, out_len, "%s%c%s", output_dir, PATH_DELIM, meta->base_name);
+    }
+
+    return out_file;
+}
+
+// range output is named for the bytes it holds (e.g. image.png.0-4096.range), so that it can't be mistaken for or
+// overwrite a full extraction of the same resource
+static char *_get_range_output_file(arp_arena_t *arena, const char *output_dir, const arp_resource_meta_t *meta,
+        uint64_t offset, uint64_t end) {
+    char *res_file = NULL;
+    if ((res_file = get_resource_output_file(arena, output_dir, meta)) == NULL) {
+        return NULL;
+    }
+
+    int suffix_len = snprintf(NULL, 0, RANGE_FILE_SUFFIX_FORMAT, (unsigned long long) offset, (unsigned long long) end);
+    size_t out_len = strlen(res_file) + (size_t) suffix_len + 1;
+    char *out_file = NULL;
+    if ((out_file = arena_alloc(arena, out_len)) == NULL) {
+        return NULL;
+    }
+
+    snprintf(out_file, out_len, "%s" RANGE_FILE_SUFFIX_FORMAT, res_file, (unsigned long long) offset,
+            (unsigned long long) end);
+    return out_file;
+}
+
+int unpack_resource_range_to_fs(const arp_resource_meta_t *meta, const char *output_dir, uint64_t offset,
+        uint64_t length, char **out_file_path) {
+    if (offset > meta->size) {
+        return ERANGE;
+    }
+
+    uint64_t end = length == RANGE_LEN_TO_END || length > meta->size - offset ? meta->size : offset + length;
+
+    unsigned char scratch[ARENA_SCRATCH_LEN];
+    arp_arena_t arena;
+    arena_init(&arena, scratch, sizeof(scratch), 0);
+
+    char *file_path = NULL;
+    if ((file_path = _get_range_output_file(&arena, output_dir, meta, offset, end)) == NULL) {
+        arena_free(&arena);
+        return ENOMEM;
+    }
+
+    FILE *out_file = NULL;
+    if ((out_file = fopen(file_path, "wb")) == NULL) {
+        int rc = errno;
+        arena_free(&arena);
+        return rc;
+    }
+
+    // an empty range (including one starting at the very end of the resource) needs nothing from the stream, and
+    // streaming toward it would otherwise inflate everything up to the offset for nothing
+    int rc = 0;
+    ArpResourceStream stream = NULL;
+    if (end > offset && (stream = arp_create_resource_stream(meta, STREAM_CHUNK_LEN)) == NULL) {
+        rc = EIO;
+    }
+
+    // the stream is abandoned as soon as the range has been satisfied, so compressed resources are only
+    // inflated as far as the end of the requested range
+    uint64_t pos = 0;
+    while (stream != NULL && pos < end) {
+        void *chunk = NULL;
+        size_t chunk_len = 0;
+        if (arp_stream_resource(stream, &chunk, &chunk_len) != 0 || chunk_len == 0) {
+            rc = EIO;
+            break;
+        }
+
+        uint64_t chunk_end = pos + chunk_len;
+        if (chunk_end > offset) {
+            uint64_t copy_start = offset > pos ? offset - pos : 0;
+            uint64_t copy_end = (end < chunk_end ? end : chunk_end) - pos;
+            size_t copy_len = (size_t) (copy_end - copy_start);
+
+            if (fwrite((unsigned char *) chunk + copy_start, 1, copy_len, out_file) != copy_len) {
+                rc = EIO;
+                break;
+            }
+        }
+
+        pos = chunk_end;
+    }
+
+    if (stream != NULL) {
+        arp_free_resource_stream(stream);
+    }
+
+    if (fclose(out_file) != 0 && rc == 0) {
+        rc = errno;
+    }
+
+    if (rc == 0 && out_file_path != NULL) {
+        size_t path_len = strlen(file_path);
+        if ((*out_file_path = malloc(path_len + 1)) == NULL) {
+            rc = ENOMEM;
+        } else {
+            memcpy(*out_file_path, file_path, path_len + 1);
+        }
+    }
+
+    if (rc != 0) {
+        remove(file_path);
+    }
+
+    arena_free(&arena);
+
+    return rc;
+}
@@ -7,9 +7,22 @@
  * license text may be accessed at https://opensource.org/licenses/MIT.
  */
 
+// clock_gettime is POSIX rather than ISO C
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "util.h"
 
+#include "arp/util/error.h"
+
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 void arptool_print(const arp_cmd_args_t *cmd_args, enum LogLevel level, const char *fmt, ...) {
 
@@ -19,10 +32,109 @@ void arptool_print(const arp_cmd_args_t *cmd_args, enum LogLevel level, const ch
         return;
     }
 
-    FILE *out_stream = level == LogLevelError ? stderr : stdout;
+    FILE *out_stream = cmd_args->capture_stream != NULL
+            ? cmd_args->capture_stream
+            : (level == LogLevelError ? stderr : stdout);
 
     va_list args;
     va_start(args, fmt);
     vfprintf(out_stream, fmt, args);
     va_end(args);
 }
+
+double get_monotonic_secs(void) {
+    // elapsed times and rates must not jump when the wall clock is adjusted, so TIME_UTC is unsuitable here
+    #ifdef _WIN32
+    LARGE_INTEGER freq;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double) counter.QuadPart / (double) freq.QuadPart;
+    #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+    #endif
+}
+
+const char *get_libarp_error(const arp_cmd_args_t *cmd_args, int rc) {
+    // libarp's error text is process-wide, so it can't be trusted while other batch jobs may be calling into libarp
+    if (cmd_args->capture_stream != NULL) {
+        return strerror(rc);
+    }
+
+    return arp_get_error();
+}
+
+static bool _match_class(const char **pattern, char c) {
+    const char *p = *pattern + 1;
+    bool negate = *p == '!' || *p == '^';
+    if (negate) {
+        p++;
+    }
+
+    bool matched = false;
+    // a leading ']' is taken literally as part of the class
+    bool first = true;
+    while (*p != '\0' && (*p != ']' || first)) {
+        first = false;
+        if (*(p + 1) == '-' && *(p + 2) != '\0' && *(p + 2) != ']') {
+            if (c >= *p && c <= *(p + 2)) {
+                matched = true;
+            }
+            p += 3;
+        } else {
+            if (c == *p) {
+                matched = true;
+            }
+            p++;
+        }
+    }
+
+    // an unterminated class is treated as a literal '['
+    if (*p != ']') {
+        return c == '[';
+    }
+
+    *pattern = p;
+    return matched != negate;
+}
+
+bool match_glob(const char *pattern, const char *str) {
+    const char *star_pattern = NULL;
+    const char *star_str = NULL;
+
+    while (*str != '\0') {
+        const char *p = pattern;
+        bool advanced = false;
+
+        if (*p == '*') {
+            // remember where the wildcard was so that we can backtrack and let it consume one more character
+            star_pattern = ++pattern;
+            star_str = str;
+            continue;
+        } else if (*p == '?') {
+            advanced = true;
+        } else if (*p == '[') {
+            advanced = _match_class(&p, *str);
+        } else if (*p != '\0') {
+            advanced = *p == *str;
+        }
+
+        if (advanced) {
+            pattern = p + 1;
+            str++;
+        } else if (star_pattern != NULL) {
+            pattern = star_pattern;
+            str = ++star_str;
+        } else {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
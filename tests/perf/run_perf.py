@@ -0,0 +1,298 @@
+#!/usr/bin/env python3
+"""Runs a synthetic pack/unpack/list workload against arptool and compares it to the stored baseline.
+
+The corpus for each workload is generated from a fixed seed, so every run (and every machine) measures exactly the same
+input. Each step is repeated and the fastest run is kept to damp scheduler noise, while peak RSS is taken from the
+worst run. The exit code is 0 if everything is within tolerance, 1 on a regression or failure, and 77 (which CTest
+treats as a skip) without measuring anything if the baseline has no entry for the workload yet.
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+EXIT_OK = 0
+EXIT_FAIL = 1
+EXIT_SKIP = 77
+
+BYTES_PER_MIB = 1024 * 1024
+
+# text-like data compresses at roughly the ratio of real assets, unlike purely random or purely repetitive bytes
+POOL_LEN = 8 * BYTES_PER_MIB
+POOL_WORDS = 4096
+POOL_RANDOM_FRACTION = 0.25
+
+CORPORA = {
+    'small_files': {
+        'seed': 0x41525031,
+        'file_count': 20000,
+        'dir_count': 200,
+        'min_size': 256,
+        'max_size': 16 * 1024,
+    },
+    'large_file': {
+        'seed': 0x41525032,
+        'file_count': 1,
+        'dir_count': 1,
+        'min_size': 128 * BYTES_PER_MIB,
+        'max_size': 128 * BYTES_PER_MIB,
+    },
+}
+
+COMPRESSION_TYPES = ('none', 'deflate')
+
+# listing a single-resource package only measures process startup, so it isn't worth tracking
+LIST_MIN_FILES = 1000
+
+RUNS_PER_STEP = 3
+
+RSS_POLL_INTERVAL = 0.002
+
+
+def _build_pool(seed):
+    rng = random.Random(seed)
+    words = [bytes(rng.choice(b'abcdefghijklmnopqrstuvwxyz') for _ in range(rng.randint(2, 12)))
+             for _ in range(POOL_WORDS)]
+
+    pool = bytearray()
+    while len(pool) < POOL_LEN:
+        if rng.random() < POOL_RANDOM_FRACTION:
+            pool += rng.getrandbits(8 * 64).to_bytes(64, 'little')
+        else:
+            pool += rng.choice(words) + b' '
+    return bytes(pool[:POOL_LEN])
+
+
+def _generate_corpus(name, spec, root):
+    stamp_path = os.path.join(root, '.stamp')
+    stamp = json.dumps(spec, sort_keys=True)
+
+    # regenerating the small-file corpus dominates the run time, so reuse it as long as the spec hasn't changed
+    if os.path.isfile(stamp_path):
+        with open(stamp_path, 'r') as stamp_file:
+            if stamp_file.read() == stamp:
+                return
+        shutil.rmtree(root)
+
+    print('Generating corpus for %s' % name)
+
+    if os.path.exists(root):
+        shutil.rmtree(root)
+
+    src_dir = os.path.join(root, 'src')
+    os.makedirs(src_dir)
+
+    rng = random.Random(spec['seed'])
+    pool = _build_pool(spec['seed'])
+
+    for i in range(spec['file_count']):
+        dir_path = os.path.join(src_dir, 'd%03d' % (i % spec['dir_count']))
+        os.makedirs(dir_path, exist_ok=True)
+
+        remaining = rng.randint(spec['min_size'], spec['max_size'])
+        with open(os.path.join(dir_path, 'f%06d.txt' % i), 'wb') as out_file:
+            while remaining > 0:
+                chunk_len = min(remaining, POOL_LEN // 2)
+                offset = rng.randrange(0, POOL_LEN - chunk_len + 1)
+                out_file.write(pool[offset:offset + chunk_len])
+                remaining -= chunk_len
+
+    with open(stamp_path, 'w') as stamp_file:
+        stamp_file.write(stamp)
+
+
+def _get_tree_size(root):
+    file_count = 0
+    total_bytes = 0
+    for dir_path, _, file_names in os.walk(root):
+        for file_name in file_names:
+            file_count += 1
+            total_bytes += os.path.getsize(os.path.join(dir_path, file_name))
+    return file_count, total_bytes
+
+
+def _clean_dir(path):
+    if os.path.exists(path):
+        shutil.rmtree(path)
+    os.makedirs(path)
+
+
+class _PeakRssMonitor(threading.Thread):
+    """Tracks the high-water RSS of a running process.
+
+    ru_maxrss can't be used for this since the kernel carries the parent's high-water mark across fork and exec, so
+    every measurement would be at least as large as this script. VmHWM belongs to the process's own address space.
+    """
+
+    def __init__(self, pid, exe_path):
+        super().__init__(daemon=True)
+        self.status_path = '/proc/%d/status' % pid
+        # the kernel truncates process names to 15 characters
+        self.exe_name = os.path.basename(exe_path)[:15]
+        self.peak_bytes = 0
+        self.stopped = threading.Event()
+
+    def run(self):
+        while not self.stopped.is_set():
+            try:
+                with open(self.status_path, 'r') as status_file:
+                    for line in status_file:
+                        # until the child execs, its status still describes a copy of this script
+                        if line.startswith('Name:') and line.split(None, 1)[1].strip() != self.exe_name:
+                            break
+                        if line.startswith('VmHWM:'):
+                            self.peak_bytes = max(self.peak_bytes, int(line.split()[1]) * 1024)
+                            break
+            except (OSError, ValueError):
+                # the process exited between polls
+                pass
+            self.stopped.wait(RSS_POLL_INTERVAL)
+
+
+def _run_step(cmd, out_dir=None):
+    """Runs the command RUNS_PER_STEP times and returns the best wall time and the worst peak RSS in bytes.
+
+    If given, out_dir is emptied before each run so that every run writes into the same fresh state.
+    """
+    best_secs = None
+    peak_rss = 0
+    for _ in range(RUNS_PER_STEP):
+        if out_dir is not None:
+            _clean_dir(out_dir)
+
+        with tempfile.TemporaryFile() as err_file:
+            start = time.perf_counter()
+            proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=err_file)
+            monitor = _PeakRssMonitor(proc.pid, cmd[0])
+            monitor.start()
+            proc.wait()
+            elapsed = time.perf_counter() - start
+            monitor.stopped.set()
+            monitor.join()
+
+            if proc.returncode != 0:
+                err_file.seek(0)
+                raise RuntimeError('%s failed:\n%s' % (' '.join(cmd), err_file.read().decode(errors='replace')))
+
+        best_secs = elapsed if best_secs is None else min(best_secs, elapsed)
+        peak_rss = max(peak_rss, monitor.peak_bytes)
+    return best_secs, peak_rss
+
+
+def _measure(arptool, workload, corpus, compression, work_dir):
+    src_dir = os.path.join(corpus, 'src')
+    file_count, total_bytes = _get_tree_size(src_dir)
+    total_mib = total_bytes / BYTES_PER_MIB
+
+    pack_dir = os.path.join(work_dir, 'pack')
+    unpack_dir = os.path.join(work_dir, 'unpack')
+    package_path = os.path.join(pack_dir, workload + '.arp')
+
+    metrics = {}
+
+    pack_cmd = [arptool, 'pack', '-q', '-c', compression, '-f', workload, '-n', 'perf', '-o', pack_dir, src_dir]
+    secs, rss = _run_step(pack_cmd, pack_dir)
+    metrics['pack_mib_per_sec'] = total_mib / secs
+    metrics['pack_peak_rss_mib'] = rss / BYTES_PER_MIB
+
+    unpack_cmd = [arptool, 'unpack', '-q', '-o', unpack_dir, package_path]
+    secs, rss = _run_step(unpack_cmd, unpack_dir)
+    metrics['unpack_mib_per_sec'] = total_mib / secs
+    metrics['unpack_peak_rss_mib'] = rss / BYTES_PER_MIB
+
+    # a fast unpack that drops data is not an improvement
+    out_count, out_bytes = _get_tree_size(unpack_dir)
+    if (out_count, out_bytes) != (file_count, total_bytes):
+        raise RuntimeError('Unpacked %d file(s) totaling %d bytes, expected %d file(s) totaling %d bytes'
+                           % (out_count, out_bytes, file_count, total_bytes))
+
+    if file_count >= LIST_MIN_FILES:
+        secs, rss = _run_step([arptool, 'list', package_path])
+        metrics['list_entries_per_sec'] = file_count / secs
+        metrics['list_peak_rss_mib'] = rss / BYTES_PER_MIB
+
+    shutil.rmtree(unpack_dir)
+    shutil.rmtree(pack_dir)
+
+    return metrics
+
+
+def _compare(workload, metrics, baseline):
+    tolerance = baseline['tolerance']
+    expected = baseline['workloads'][workload]
+
+    failed = False
+    print('%-24s %12s %12s %9s' % ('METRIC', 'BASELINE', 'MEASURED', 'CHANGE'))
+    for key in sorted(metrics):
+        measured = metrics[key]
+        if key not in expected:
+            print('%-24s %12s %12.1f %9s' % (key, '-', measured, 'new'))
+            continue
+
+        base = expected[key]
+        change = (measured - base) / base if base > 0 else 0.0
+
+        # throughput may drop and memory may grow by up to the tolerance before it counts as a regression
+        if key.endswith('_per_sec'):
+            regressed = measured < base * (1.0 - tolerance['throughput'])
+        else:
+            regressed = measured > base * (1.0 + tolerance['peak_rss'])
+
+        flag = '  REGRESSED' if regressed else ''
+        print('%-24s %12.1f %12.1f %+8.1f%%%s' % (key, base, measured, change * 100, flag))
+        failed = failed or regressed
+
+    return not failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--arptool', required=True, help='path to the arptool executable under test')
+    parser.add_argument('--workload', required=True,
+                        choices=['%s_%s' % (c, t) for c in CORPORA for t in COMPRESSION_TYPES])
+    parser.add_argument('--baseline', required=True, help='path to the baseline JSON file')
+    parser.add_argument('--work-dir', required=True, help='scratch directory for corpora and outputs')
+    parser.add_argument('--update-baseline', action='store_true',
+                        help='record the measurements as the new baseline instead of comparing against it')
+    args = parser.parse_args()
+
+    corpus_name, compression = args.workload.rsplit('_', 1)
+    corpus_dir = os.path.join(args.work_dir, 'corpus', corpus_name)
+    run_dir = os.path.join(args.work_dir, 'run', args.workload)
+
+    with open(args.baseline, 'r') as baseline_file:
+        baseline = json.load(baseline_file)
+
+    # measuring takes a while, so don't bother when there's nothing to compare against or record
+    if not args.update_baseline and args.workload not in baseline['workloads']:
+        print('No baseline recorded for %s, rerun with --update-baseline to record one' % args.workload)
+        return EXIT_SKIP
+
+    _generate_corpus(corpus_name, CORPORA[corpus_name], corpus_dir)
+
+    try:
+        metrics = _measure(os.path.abspath(args.arptool), args.workload, corpus_dir, compression, run_dir)
+    except RuntimeError as e:
+        print(e)
+        return EXIT_FAIL
+
+    if args.update_baseline:
+        baseline['workloads'][args.workload] = {key: round(val, 1) for key, val in sorted(metrics.items())}
+        with open(args.baseline, 'w') as baseline_file:
+            json.dump(baseline, baseline_file, indent=4, sort_keys=True)
+            baseline_file.write('\n')
+        print('Recorded baseline for %s' % args.workload)
+        return EXIT_OK
+
+    return EXIT_OK if _compare(args.workload, metrics, baseline) else EXIT_FAIL
+
+
+if __name__ == '__main__':
+    sys.exit(main())
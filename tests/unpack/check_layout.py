@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Checks that unpacking with --io-uring produces exactly the same tree as libarp's own unpacking.
+
+The corpus covers the cases where the batched writer could lay files out differently from arp_unpack_to_fs: nested and
+empty directories, dotfiles, files without an extension, empty files, and files around the preallocation and streaming
+thresholds. The exit code is 0 if both trees match path by path and byte by byte, 1 on any difference or failure, and 77
+(which CTest treats as a skip) if arptool was built without io_uring support.
+"""
+
+import argparse
+import filecmp
+import os
+import random
+import shutil
+import subprocess
+import sys
+
+EXIT_OK = 0
+EXIT_FAIL = 1
+EXIT_SKIP = 77
+
+BYTES_PER_MIB = 1024 * 1024
+
+CORPUS_SEED = 0x41525033
+
+# sizes straddle the writer's 1 MiB preallocation and 16 MiB streaming thresholds
+CORPUS_FILES = {
+    'root.txt': 1024,
+    'no_extension': 300,
+    'empty.txt': 0,
+    '.hidden': 64,
+    'a/b/c/deep.txt': 4096,
+    'a/b/sibling.bin': 1,
+    'a/dup.txt': 10,
+    'b/dup.txt': 20,
+    'sizes/under_prealloc.bin': BYTES_PER_MIB - 1,
+    'sizes/at_prealloc.bin': BYTES_PER_MIB,
+    'sizes/under_stream.bin': 16 * BYTES_PER_MIB,
+    'sizes/over_stream.bin': 16 * BYTES_PER_MIB + 1,
+}
+
+# whether these survive packing is up to libarp, but both unpackers must agree on it
+CORPUS_EMPTY_DIRS = (
+    'empty_dir',
+    'a/empty_nested',
+)
+
+UNAVAILABLE_MSG = 'io_uring is unavailable'
+
+
+def _generate_corpus(root):
+    rng = random.Random(CORPUS_SEED)
+    for rel_path, size in sorted(CORPUS_FILES.items()):
+        path = os.path.join(root, *rel_path.split('/'))
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, 'wb') as out_file:
+            out_file.write(rng.getrandbits(8 * size).to_bytes(size, 'little') if size > 0 else b'')
+
+    for rel_path in CORPUS_EMPTY_DIRS:
+        os.makedirs(os.path.join(root, *rel_path.split('/')), exist_ok=True)
+
+
+def _list_tree(root):
+    dirs = set()
+    files = set()
+    for dir_path, dir_names, file_names in os.walk(root):
+        rel_dir = os.path.relpath(dir_path, root)
+        for dir_name in dir_names:
+            dirs.add(os.path.normpath(os.path.join(rel_dir, dir_name)))
+        for file_name in file_names:
+            files.add(os.path.normpath(os.path.join(rel_dir, file_name)))
+    return dirs, files
+
+
+def _run(cmd):
+    proc = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    output = proc.stdout.decode(errors='replace')
+    if proc.returncode != 0:
+        raise RuntimeError('%s failed:\n%s' % (' '.join(cmd), output))
+    return output
+
+
+def _compare_trees(expected_root, actual_root):
+    expected_dirs, expected_files = _list_tree(expected_root)
+    actual_dirs, actual_files = _list_tree(actual_root)
+
+    problems = []
+    for path in sorted(expected_dirs - actual_dirs):
+        problems.append('missing directory %s' % path)
+    for path in sorted(actual_dirs - expected_dirs):
+        problems.append('unexpected directory %s' % path)
+    for path in sorted(expected_files - actual_files):
+        problems.append('missing file %s' % path)
+    for path in sorted(actual_files - expected_files):
+        problems.append('unexpected file %s' % path)
+
+    for path in sorted(expected_files & actual_files):
+        if not filecmp.cmp(os.path.join(expected_root, path), os.path.join(actual_root, path), shallow=False):
+            problems.append('contents differ for %s' % path)
+
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--arptool', required=True, help='path to the arptool executable under test')
+    parser.add_argument('--work-dir', required=True, help='scratch directory for the corpus and outputs')
+    args = parser.parse_args()
+
+    arptool = os.path.abspath(args.arptool)
+
+    if os.path.exists(args.work_dir):
+        shutil.rmtree(args.work_dir)
+
+    src_dir = os.path.join(args.work_dir, 'src')
+    pack_dir = os.path.join(args.work_dir, 'pack')
+    expected_dir = os.path.join(args.work_dir, 'expected')
+    actual_dir = os.path.join(args.work_dir, 'actual')
+
+    _generate_corpus(src_dir)
+
+    try:
+        _run([arptool, 'pack', '-q', '-f', 'layout', '-n', 'layout', '-o', pack_dir, src_dir])
+        package_path = os.path.join(pack_dir, 'layout.arp')
+
+        _run([arptool, 'unpack', '-o', expected_dir, package_path])
+        output = _run([arptool, 'unpack', '--io-uring', '-o', actual_dir, package_path])
+    except RuntimeError as e:
+        print(e)
+        return EXIT_FAIL
+
+    if UNAVAILABLE_MSG in output:
+        print('arptool could not use io_uring here, nothing to compare')
+        return EXIT_SKIP
+
+    problems = _compare_trees(expected_dir, actual_dir)
+    if problems:
+        print('io_uring unpack differs from libarp unpack:')
+        for problem in problems:
+            print('  ' + problem)
+        return EXIT_FAIL
+
+    print('io_uring unpack matches libarp unpack')
+    shutil.rmtree(args.work_dir)
+    return EXIT_OK
+
+
+if __name__ == '__main__':
+    sys.exit(main())